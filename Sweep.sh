@@ -0,0 +1,22 @@
+#! /bin/bash
+
+set -x
+
+# Each range is FIRST[:LAST[:STEP]]; every combination runs as its own
+# shop, concurrently on all cores, and prints one CSV row.
+
+NBARBERS=2:3
+NCHAIRS=1:7
+SERVICE_TIME=1200:8000:400
+SERVICE_DEVIATION=100:200:100
+CUSTOMER_ARRIVALS=400:800:200
+DURATION_SECONDS=300
+
+./main --sweep \
+	    $NBARBERS \
+	        $NCHAIRS \
+		    $SERVICE_TIME \
+		        $SERVICE_DEVIATION \
+			    $CUSTOMER_ARRIVALS \
+			       $DURATION_SECONDS \
+				   --virtual > sweep-output.csv
@@ -1 +1,2 @@
-g++ -std=c++14 -Wall -Werror -pedantic -pthread -o0 main.cpp -o main
+g++ -std=c++20 -Wall -Werror -pedantic -pthread -o0 main.cpp -o main
+g++ -std=c++20 -Wall -Werror -pedantic -pthread -O2 -DBARBERS_BENCH main.cpp -o bench
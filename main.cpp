@@ -8,21 +8,45 @@
 //Implementation: Ahmed Nada
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cmath>
+#include <coroutine>
 #include <cstdio>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <new>
 #include <pthread.h>
 #include <queue>
 #include <random>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <climits>
+#include <string>
 #include <time.h>
+#include <unordered_map>
 #include <unistd.h>
 #include <vector>
 #include<stdio.h>
 #include<stdlib.h>
 #include<unistd.h>
 #include<errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
 #include<sys/ipc.h>
 #include <queue>
 #include <iostream>
@@ -39,596 +63,6202 @@ enum customer_status { // enums but not used
 const char* PROG_NAME = "";
 
 class Shop;
+class ShopCluster;
+class WaitingRoom;
+class IdleBarbers;
 class Barber;
 class Customer;
 
-class Lock {
+enum log_message { // every per-event line the simulation prints (also the event trace's event codes: append only)
+    shop_creates_barbers, shop_creates_virtual_barbers, shop_opens, shop_closes,
+    barber_arrives, barber_calls, barber_leaves, barber_naps, barber_sent_home,
+    barber_wakes, barber_cuts, barber_finishes, barber_paid,
+    customer_arrived, customer_takes_seat, customer_leaves_unserved, customer_wakes_barber,
+    customer_sits_down, customer_pays, customer_leaves, customer_deleted,
+    shop_warmed_up
+};
+
+// Asynchronous event log.  Instead of writing each line through
+// cout/endl (one flush and one shared stream lock per event), a thread
+// appends a small fixed-size record to its own single-producer ring;
+// a background writer thread drains every ring in batches, orders the
+// batch by timestamp and formats the text.  With verbosity 0 nothing
+// is recorded and only the summary is printed, unless the records are
+// also going to a binary event trace (--event-trace).
+class EventLog {
 public:
+    EventLog() : verbosity(1), running(false), stopping(false), trace(nullptr) {
+        pthread_mutex_init(&this->registry_mutex, NULL);
+        pthread_mutex_init(&this->drain_mutex, NULL);
+    }
 
-    Lock(pthread_mutex_t* mutex) : mutex(mutex) {
-        int rc = pthread_mutex_lock(this->mutex);
-        if (rc < 0) {
-            perror("can't lock mutex");
-            exit(EXIT_FAILURE);
-        }
+    // Start the writer thread.  Until then (and at verbosity 0 without
+    // a trace) log() is a no-op.
+    void start(int verbosity, const string& trace_path = "");
+
+    // Timestamp the calling thread's records with clock(context)
+    // instead of the steady clock (virtual time); nullptr restores the
+    // steady clock.  Per thread: each virtual shop of a sweep or a
+    // replication runs on its own thread with its own clock.
+    void set_clock(long long (*clock)(const void*), const void* context) {
+        thread_clock = clock;
+        thread_clock_context = context;
     }
 
-    ~Lock() {
-        int rc = pthread_mutex_unlock(mutex);
-        if (rc < 0) {
-            perror("can't unlock mutex");
-            exit(EXIT_FAILURE);
+    // Write everything logged so far, then stop the writer thread.
+    void stop();
+
+    // Write everything logged so far (e.g. before the summary).
+    void flush();
+
+    // In a process forked from a logging one (--what-if): the writer
+    // thread did not survive fork(), so record nothing from now on.
+    void detach() {
+        this->running = false;
+        this->trace = nullptr; // the parent writes and closes it
+    }
+
+    void log(log_message message, int a = 0, int b = 0) {
+        if (!this->running.load(memory_order_relaxed)) {
+            return;
+        }
+        LogBuffer* buffer = this->thread_buffer();
+        size_t tail = buffer->tail.load(memory_order_relaxed);
+        while (tail - buffer->head.load(memory_order_acquire) >= LOG_BUFFER_SIZE) {
+            sched_yield(); // ring full: wait for the writer to catch up
         }
+        LogRecord& record = buffer->records[tail % LOG_BUFFER_SIZE];
+        record.time = thread_clock != nullptr ? thread_clock(thread_clock_context)
+                : chrono::steady_clock::now().time_since_epoch().count();
+        record.thread = buffer->thread;
+        record.message = message;
+        record.a = a;
+        record.b = b;
+        buffer->tail.store(tail + 1, memory_order_release);
     }
 
 private:
-    pthread_mutex_t* mutex;
-};
+    static const size_t LOG_BUFFER_SIZE = 512;
 
-class Shop {
-public:
-    bool shop_open = true;
+    struct LogRecord {
+        long long time;
+        uint32_t thread; // logging thread, numbered in order of its first record
+        log_message message;
+        int a;
+        int b;
+    };
 
-    struct BarberOrWait {
-        Barber* barber; // Barber is available
-        bool chair_available; // If barber isn't available,
-        // waiting chair is available.
+    struct LogBuffer { // written by one thread, drained by the writer
+        LogRecord records[LOG_BUFFER_SIZE];
+        uint32_t thread;
+        atomic<size_t> head{0};
+        atomic<size_t> tail{0};
+        atomic<bool> retired{false}; // owning thread has exited
     };
 
-    // Constructor initializes shop and creates Barber threads (which
-    // will immediately start calling next_customer to fill the
-    // collection of sleeping barbers).
-    Shop(int n_barbers,
-            unsigned int waiting_chairs,
-            int average_service_time,
-            int service_time_deviation,
-            int average_customer_arrival,
-            int duration);
+    struct BufferOwner { // retires the thread's buffer when the thread exits
+        LogBuffer* buffer = nullptr;
+        ~BufferOwner() {
+            if (this->buffer != nullptr) {
+                this->buffer->retired.store(true, memory_order_release);
+            }
+        }
+    };
 
-    // Main thread: open the shop and spawn customer threads until
-    // closing time.  Report summary statistics for the day.
-    void run();
+    LogBuffer* thread_buffer();
+    static void* run_writer(void* arg);
+    void drain();
+    static void format(string& out, const LogRecord& record);
 
-    // Customer thread announces arrival to shop. If the collection of
-    // currently sleeping barbers is not empty, remove and return one
-    // barber from the collection. If all the barbers are busy and there
-    // is an empty chair in the waiting room, add the customer to the
-    // waiting queue and return {nullptr, true}.  Otherwise, the
-    // customer will leave: return {nullptr, false}.
-    BarberOrWait arrives(Customer* customer);
+    int verbosity;
+    atomic<bool> running;
+    atomic<bool> stopping;
+    pthread_t writer;
+    pthread_mutex_t registry_mutex; // guards buffers; held while draining
+    pthread_mutex_t drain_mutex; // one drain at a time: a batch is written before the next is taken
+    vector<LogBuffer*> buffers;
+    uint32_t threads = 0; // buffers ever registered, under registry_mutex
+    FILE* trace; // --event-trace
+    string trace_path;
+    static thread_local long long (*thread_clock)(const void*);
+    static thread_local const void* thread_clock_context;
+};
 
-    // Barber thread requests next customer.  If no customers are
-    // currently waiting, add the barber to the collection of
-    // currently sleeping barbers and return nullptr.
-    Customer* next_customer(Barber* barber);
+// Binary event trace (--event-trace): a header followed by one
+// fixed-size record per event_log.log call, in timestamp order within
+// each writer batch.  main --trace-json converts it for chrome://tracing
+// or Perfetto.
+struct EventTraceHeader {
+    char magic[4]; // "BSET"
+    uint32_t version;
+    uint32_t record_size; // sizeof (EventTraceRecord)
+    uint32_t reserved;
+};
 
-    // Return random service time
-    int service_time();
+struct EventTraceRecord {
+    int64_t time; // nanoseconds (steady clock, or virtual time)
+    uint32_t thread; // logging thread
+    uint32_t event; // log_message
+    int32_t a; // first entity id (barber or customer, as in the text line)
+    int32_t b; // second entity id
+};
 
-    // Return random customer arrival.
-    int customer_arrival_time();
-    //pthread_cond_t * cond_barber; //array
-    //pthread_cond_t * cond_customer;
+EventLog event_log;
+thread_local long long (*EventLog::thread_clock)(const void*) = nullptr;
+thread_local const void* EventLog::thread_clock_context = nullptr;
 
-    pthread_mutex_t* shop_mutex;
-    pthread_mutex_t* nextcustomer_mutex;
+EventLog::LogBuffer* EventLog::thread_buffer() {
+    static thread_local BufferOwner owner;
+    if (owner.buffer == nullptr) {
+        owner.buffer = new LogBuffer();
+        pthread_mutex_lock(&this->registry_mutex);
+        owner.buffer->thread = this->threads++;
+        this->buffers.push_back(owner.buffer);
+        pthread_mutex_unlock(&this->registry_mutex);
+    }
+    return owner.buffer;
+}
 
-private:
-    vector<pthread_t*> barber_threads;
-    struct timespec time_limit;
-    int customers_served_immediately;
-    int customers_waited;
-    int customers_turned_away=0;
-    int customers_total;
-    queue<Customer*> chairs;
-    queue<Barber*> sleeping_barbers;
-    int average_customer_arrival;
-    int service_time_deviation;
-    int average_service_time;
-    int n_barbers;
-    //Barber* barbers_array;
-    unsigned int waiting_chairs; // should be unsigned 
-    queue <pthread_t*> customer_thread_queue;
-    void close();
-    void cleanup();
+void EventLog::start(int verbosity, const string& trace_path) {
+    this->verbosity = verbosity;
+    if (!trace_path.empty()) {
+        this->trace_path = trace_path;
+        this->trace = fopen(trace_path.c_str(), "wb");
+        EventTraceHeader header;
+        memcpy(header.magic, "BSET", 4);
+        header.version = 1;
+        header.record_size = sizeof (EventTraceRecord);
+        header.reserved = 0;
+        if (this->trace == nullptr || fwrite(&header, sizeof header, 1, this->trace) != 1) {
+            perror(trace_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (verbosity == 0 && this->trace == nullptr) {
+        return;
+    }
+    this->stopping = false;
+    int rc = pthread_create(&this->writer, nullptr, run_writer, reinterpret_cast<void*> (this));
+    if (rc != 0) {
+        errno = rc;
+        perror("creating pthread");
+        exit(EXIT_FAILURE);
+    }
+    this->running = true;
+}
+
+void EventLog::stop() {
+    if (!this->running) {
+        return;
+    }
+    this->stopping = true;
+    pthread_join(this->writer, nullptr);
+    this->running = false;
+    this->drain();
+    if (this->trace != nullptr) {
+        if (fclose(this->trace) != 0) {
+            perror(this->trace_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+        this->trace = nullptr;
+    }
+}
+
+void EventLog::flush() {
+    if (this->running) {
+        this->drain();
+    }
+}
+
+void* EventLog::run_writer(void* arg) {
+    EventLog* log = reinterpret_cast<EventLog*> (arg);
+    while (!log->stopping) {
+        log->drain();
+        usleep(10 * 1000); // batch up about 10 ms of events per write
+    }
+    return nullptr;
+}
+
+void EventLog::drain() {
+    vector<LogRecord> batch;
+    pthread_mutex_lock(&this->drain_mutex); // flush() returns only once the writer's batch is out too
+    pthread_mutex_lock(&this->registry_mutex);
+    for (size_t i = 0; i < this->buffers.size();) {
+        LogBuffer* buffer = this->buffers[i];
+        bool retired = buffer->retired.load(memory_order_acquire);
+        size_t head = buffer->head.load(memory_order_relaxed);
+        size_t tail = buffer->tail.load(memory_order_acquire);
+        for (; head != tail; head++) {
+            batch.push_back(buffer->records[head % LOG_BUFFER_SIZE]);
+        }
+        buffer->head.store(head, memory_order_release);
+        if (retired) { // owner exited and everything it wrote is in the batch
+            delete buffer;
+            this->buffers[i] = this->buffers.back();
+            this->buffers.pop_back();
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&this->registry_mutex);
+
+    if (batch.empty()) {
+        pthread_mutex_unlock(&this->drain_mutex);
+        return;
+    }
+    stable_sort(batch.begin(), batch.end(), [](const LogRecord& x, const LogRecord& y) {
+        return x.time < y.time;
+    });
+    if (this->trace != nullptr) {
+        vector<EventTraceRecord> records;
+        records.reserve(batch.size());
+        for (const LogRecord& record : batch) {
+            records.push_back({record.time, record.thread, (uint32_t) record.message, record.a, record.b});
+        }
+        if (fwrite(records.data(), sizeof (EventTraceRecord), records.size(), this->trace) != records.size()) {
+            perror(this->trace_path.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (this->verbosity == 0) {
+        pthread_mutex_unlock(&this->drain_mutex);
+        return;
+    }
+    string out;
+    for (const LogRecord& record : batch) {
+        format(out, record);
+    }
+    cout.write(out.data(), out.size());
+    cout.flush();
+    pthread_mutex_unlock(&this->drain_mutex);
+}
+
+void EventLog::format(string& out, const LogRecord& record) {
+    char line[128];
+    int a = record.a;
+    int b = record.b;
+    switch (record.message) {
+        case shop_creates_barbers:
+            snprintf(line, sizeof line, "Creating Barber Threads %d barbers\n", a);
+            break;
+        case shop_creates_virtual_barbers:
+            snprintf(line, sizeof line, "Creating %d virtual barbers\n", a);
+            break;
+        case shop_opens:
+            snprintf(line, sizeof line, "the Barber shop opens\n");
+            break;
+        case shop_closes:
+            snprintf(line, sizeof line, "the shop closes\n");
+            break;
+        case barber_arrives:
+            snprintf(line, sizeof line, "Barber %d arrives for work\n", a);
+            break;
+        case barber_calls:
+            snprintf(line, sizeof line, "Barber %d calls customer %d\n", a, b);
+            break;
+        case barber_leaves:
+            snprintf(line, sizeof line, "No more customers and shop is closed, barber %d leaves for home\n", a);
+            break;
+        case barber_naps:
+            snprintf(line, sizeof line, "Barber %d goes for a nap\n", a);
+            break;
+        case barber_sent_home:
+            snprintf(line, sizeof line, "Wake up barber %d !!! please go home\n", a);
+            break;
+        case barber_wakes:
+            snprintf(line, sizeof line, "Barber %d wakes up\n", a);
+            break;
+        case barber_cuts:
+            snprintf(line, sizeof line, "Barber %d gives customer %d a haircut \n", a, b);
+            break;
+        case barber_finishes:
+            snprintf(line, sizeof line, "Barber %d finishes customer %d's haircut \n", a, b);
+            break;
+        case barber_paid:
+            snprintf(line, sizeof line, "Barber %d accepts payment from customer %d\n", a, b);
+            break;
+        case customer_arrived:
+            snprintf(line, sizeof line, "Customer %d arrived at the shop\n", a);
+            break;
+        case customer_takes_seat:
+            snprintf(line, sizeof line, "Customer %d takes a seat in the waiting room\n", a);
+            break;
+        case customer_leaves_unserved:
+            snprintf(line, sizeof line, "Customer %d leaves without getting a hair cut\n", a);
+            break;
+        case customer_wakes_barber:
+            snprintf(line, sizeof line, "Customer %d wakes barber %d\n", a, b);
+            break;
+        case customer_sits_down:
+            snprintf(line, sizeof line, "Customer %d sits in barber's %d chair\n", a, b);
+            break;
+        case customer_pays:
+            snprintf(line, sizeof line, "Customer %d gets up and proffers payment to barber %d\n", a, b);
+            break;
+        case customer_leaves:
+            snprintf(line, sizeof line, "Customer %d leaves statisfied\n", a);
+            break;
+        case customer_deleted:
+            snprintf(line, sizeof line, "Calling Customer destructor: Deleting customer\n");
+            break;
+        case shop_warmed_up:
+            snprintf(line, sizeof line, "the warm-up is over: statistics start now\n");
+            break;
+    }
+    out += line;
+}
+
+enum handshake_state { // --futex: one state word per Barber and per Customer
+    hs_asleep, // barber: no customer / customer: waiting for a barber
+    hs_awakened, // barber: a customer woke him up
+    hs_called, // customer: a barber called him to the chair
+    hs_seated, // barber: the customer sat down
+    hs_done, // customer: haircut finished
+    hs_paid, // barber: customer paid / customer: payment accepted
+    hs_gohome // barber: shop closed while he was asleep
 };
 
-class Barber {
-public:
-    bool gohome; // boolean to mark if it is time for the barber to go home after being sleeping
-    bool givinghaircut; // boolean to control the barber status
-    bool hassitting; // boolean to control barber status, has a customer sitting on the chair so he should start serving
-    bool gotpaid; // boolean to control barber status, whether he got paid or not
+// Futex helpers for the --futex handshake.  A waiter spins briefly,
+// then sleeps in the kernel until the word changes; a signaller stores
+// the new state and wakes the (single) waiter.
+void futex_wake(atomic<int>& word) {
+    syscall(SYS_futex, reinterpret_cast<int*> (&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
 
-    Barber(Shop* shop, int id);
+void futex_post(atomic<int>& word, int state) {
+    word.store(state, memory_order_release);
+    futex_wake(word);
+}
 
-    // Barber thread function.
-    void run();
+// Wait until the word leaves `state`; return the new state.
+int futex_wait_while(atomic<int>& word, int state) {
+    int value;
+    for (int spin = 0; spin < 100; spin++) {
+        if ((value = word.load(memory_order_acquire)) != state) {
+            return value;
+        }
+    }
+    while ((value = word.load(memory_order_acquire)) == state) {
+        syscall(SYS_futex, reinterpret_cast<int*> (&word), FUTEX_WAIT_PRIVATE, state, nullptr, nullptr, 0);
+    }
+    return value;
+}
 
-    // Shop tells barber it's closing time.
-    void closing_time();
+// Wait until the word reaches `state`.
+void futex_wait_for(atomic<int>& word, int state) {
+    int value = word.load(memory_order_acquire);
+    while (value != state) {
+        value = futex_wait_while(word, value);
+    }
+}
 
-    // Customer wakes up barber.
-    void awaken(Customer* customer);
+class CoScheduler;
 
-    // Customer sits in barber's chair.
-    void customer_sits();
+// Fire-and-forget coroutine for barbers and customers in --coroutines
+// mode.  It starts suspended; CoScheduler::spawn queues it, and its
+// frame is freed as soon as it finishes.
+struct CoTask {
+    struct promise_type {
+        CoScheduler* scheduler = nullptr;
 
-    // Customer proffers payment.
-    void payment();
+        CoTask get_return_object() {
+            return CoTask{coroutine_handle<promise_type>::from_promise(*this)};
+        }
 
-    /*const*/ int id = 0;
+        suspend_always initial_suspend() noexcept {
+            return {};
+        }
 
-private:
-    Customer* myCustomer; // a barber has a customer
-    pthread_cond_t* cond_barber; // cond variable for the barber
-    pthread_mutex_t* barber_mutex; // barber mutex
-    barber_status barber_state; // each barber has a state from the enums but it is not used
-    Shop* shop;
+        struct FinalAwaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+            void await_suspend(coroutine_handle<promise_type> handle) noexcept;
+            void await_resume() noexcept {
+            }
+        };
 
-    Barber(const Barber&) = delete;
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {
+        }
+
+        void unhandled_exception() {
+            terminate();
+        }
+    };
+
+    coroutine_handle<promise_type> handle;
 };
 
-class Customer {
+// Small scheduler for --coroutines mode: a run queue and a timer heap
+// shared by a few worker threads.  Barbers and customers run on it as
+// CoTasks; a haircut is a timer rather than a sleeping thread.
+class CoScheduler {
 public:
-    bool awakenedbarber; // a boolean to control Customer states, customer awakened the barber
-    bool hadhaircut; // a boolean to control if a customer has had his haircut
-    bool paid; // a boolean to control if the customer paid the barber or not
-    
-    Customer();
-    Customer(Shop* shop, int id);
-    ~Customer();
+    CoScheduler(int n_workers);
 
-    void run();
+    // Queue a new task (counted until it finishes).
+    void spawn(CoTask task);
 
-    // Barber calls this customer after checking the waiting-room
-    // queue (customer should be waitint).
-    void next_customer(Barber* barber);
+    // Make a suspended coroutine runnable.
+    void schedule(coroutine_handle<> handle);
 
-    // Barber finishes haircut (Customer should be receiving haircut).
-    void finished();
+    // Awaitable: resume the coroutine after `milliseconds`.
+    struct Sleep {
+        CoScheduler* scheduler;
+        long long deadline;
+        bool await_ready() {
+            return false;
+        }
+        void await_suspend(coroutine_handle<> handle) {
+            this->scheduler->schedule_at(this->deadline, handle);
+        }
+        void await_resume() {
+        }
+    };
+    Sleep sleep_for(int milliseconds);
 
-    // Barber has accepted payment for service.
-    void payment_accepted();
+    // Wait until every spawned task has finished, then stop and join
+    // the workers.
+    void drain();
 
-    /*const*/ int id /*= 0*/;
+    void task_done();
 
 private:
-    Shop* shop;
-    Barber* myBarber; // a customer has a barber to serve him
-    pthread_cond_t* cond_customer; // conditional variable for the customer
-    pthread_mutex_t* customer_mutex; // mutex for the customer
-    customer_status customer_state; // customer enum
-    // Customer thread function.
+    static long long monotonic_now();
+    static void* run_worker(void* arg);
+    void work();
+    void schedule_at(long long deadline, coroutine_handle<> handle);
 
-    Customer(const Customer&) = delete; // to prevent calling copy constructor
+    struct Timer {
+        long long deadline;
+        unsigned long seq;
+        coroutine_handle<> handle;
+        bool operator>(const Timer& other) const {
+            return this->deadline != other.deadline ? this->deadline > other.deadline : this->seq > other.seq;
+        }
+    };
 
+    pthread_mutex_t mutex; // guards everything below
+    pthread_cond_t work_cond; // runnable task or earlier timer
+    pthread_cond_t idle_cond; // live dropped to zero
+    deque<coroutine_handle<>> runnable;
+    priority_queue<Timer, vector<Timer>, greater<Timer>> timers;
+    unsigned long timer_seq;
+    long live; // spawned tasks not yet finished
+    bool stopping;
+    vector<pthread_t> workers;
 };
 
-Barber::Barber(Shop* shop, int id) {
-    this->gotpaid=false; // setting all conditions ti false
-    this->givinghaircut=false;
-    this->hassitting=false;
-    this->gohome = false;
-    this->id = id;
-    this->shop = shop;
-    this->myCustomer = nullptr;
-    this->cond_barber = reinterpret_cast<pthread_cond_t*> (malloc(sizeof (pthread_cond_t))); // allocting mem for cond var
-    pthread_cond_init(this->cond_barber, NULL); // initializing the cond variable
-    this->barber_mutex = reinterpret_cast<pthread_mutex_t*> (malloc(sizeof (pthread_mutex_t))); // allocating mem for mutex
-    pthread_mutex_init(barber_mutex, NULL); // intializing the mutex
-}
+// Single-waiter, auto-reset event a coroutine can co_await.  set()
+// before the wait makes the next co_await return immediately; callers
+// re-check their state word around the wait, so a set() consumed by an
+// earlier wait is never lost.
+class CoEvent {
+public:
+    CoEvent() : flag(idle) {
+    }
 
-// Barber thread.  Must be joined by Shop thread to allow shop to
-// determine when barbers have left.
+    void reset() {
+        this->flag.store(idle, memory_order_relaxed);
+    }
 
-void* run_barber(void* arg) {
-    Barber* barber = reinterpret_cast<Barber*> (arg);
-    barber->run();
-    return nullptr;
+    void set(CoScheduler* scheduler) {
+        if (this->flag.exchange(signalled, memory_order_acq_rel) == waiting) {
+            scheduler->schedule(this->waiter);
+        }
+    }
+
+    bool await_ready() {
+        int expected = signalled;
+        return this->flag.compare_exchange_strong(expected, idle, memory_order_acq_rel);
+    }
+
+    bool await_suspend(coroutine_handle<> handle) {
+        this->waiter = handle;
+        int expected = idle;
+        if (this->flag.compare_exchange_strong(expected, waiting, memory_order_acq_rel)) {
+            return true;
+        }
+        this->flag.store(idle, memory_order_relaxed); // set() raced in: consume it and keep going
+        return false;
+    }
+
+    void await_resume() {
+        int expected = signalled;
+        this->flag.compare_exchange_strong(expected, idle, memory_order_acq_rel);
+    }
+
+private:
+    enum { idle, signalled, waiting };
+    atomic<int> flag;
+    coroutine_handle<> waiter;
+};
+
+CoScheduler::CoScheduler(int n_workers) : timer_seq(0), live(0), stopping(false) {
+    pthread_mutex_init(&this->mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // timers are on the monotonic clock
+    pthread_cond_init(&this->work_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&this->idle_cond, NULL);
+    this->workers.resize(n_workers);
+    for (auto& worker : this->workers) {
+        int rc = pthread_create(&worker, nullptr, run_worker, reinterpret_cast<void*> (this));
+        if (rc != 0) {
+            errno = rc;
+            perror("creating pthread");
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
-void Barber::closing_time() { // function to turn the boolean of go home to true so that the barber knows the shop has closed
-    pthread_mutex_lock(this->barber_mutex);
-    this->gohome = true;
-    pthread_cond_signal(this->cond_barber);
-    pthread_mutex_unlock(this->barber_mutex);
+long long CoScheduler::monotonic_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
 }
 
-void Barber::awaken(Customer* customer) { // function to assign a customer to the barber
-    pthread_mutex_lock(this->barber_mutex);
-    this->myCustomer = customer;
-    pthread_cond_signal(this->cond_barber);
-    pthread_mutex_unlock(this->barber_mutex);
+void CoTask::promise_type::FinalAwaiter::await_suspend(coroutine_handle<promise_type> handle) noexcept {
+    CoScheduler* scheduler = handle.promise().scheduler;
+    handle.destroy();
+    scheduler->task_done();
 }
 
-void Barber::customer_sits() { // function to let the barber know it has a customer sitting 
-    pthread_mutex_lock(this->barber_mutex);
-    this->hassitting = true;
-    pthread_cond_signal(cond_barber);
-    pthread_mutex_unlock(this->barber_mutex);
+void CoScheduler::spawn(CoTask task) {
+    task.handle.promise().scheduler = this;
+    pthread_mutex_lock(&this->mutex);
+    this->live++;
+    pthread_mutex_unlock(&this->mutex);
+    this->schedule(task.handle);
 }
 
-void Barber::payment() { // function to let the barber know if the customer has paid him or not
-    pthread_mutex_lock(this->barber_mutex);
-    this->gotpaid = true;
-    pthread_cond_signal(cond_barber);
-    pthread_mutex_unlock(this->barber_mutex);
+void CoScheduler::task_done() {
+    pthread_mutex_lock(&this->mutex);
+    if (--this->live == 0) {
+        pthread_cond_broadcast(&this->idle_cond);
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void CoScheduler::schedule(coroutine_handle<> handle) {
+    pthread_mutex_lock(&this->mutex);
+    this->runnable.push_back(handle);
+    pthread_cond_signal(&this->work_cond);
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void CoScheduler::schedule_at(long long deadline, coroutine_handle<> handle) {
+    pthread_mutex_lock(&this->mutex);
+    bool earliest = this->timers.empty() || deadline < this->timers.top().deadline;
+    this->timers.push({deadline, this->timer_seq++, handle});
+    if (earliest) { // a waiting worker may need to wake sooner
+        pthread_cond_signal(&this->work_cond);
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+CoScheduler::Sleep CoScheduler::sleep_for(int milliseconds) {
+    return Sleep{this, monotonic_now() + milliseconds * 1000000LL};
+}
+
+void* CoScheduler::run_worker(void* arg) {
+    reinterpret_cast<CoScheduler*> (arg)->work();
+    return nullptr;
+}
+
+void CoScheduler::work() {
+    pthread_mutex_lock(&this->mutex);
+    while (true) {
+        long long now = monotonic_now();
+        while (!this->timers.empty() && this->timers.top().deadline <= now) { // expired timers become runnable
+            this->runnable.push_back(this->timers.top().handle);
+            this->timers.pop();
+        }
+        if (!this->runnable.empty()) {
+            coroutine_handle<> handle = this->runnable.front();
+            this->runnable.pop_front();
+            pthread_mutex_unlock(&this->mutex);
+            handle.resume();
+            pthread_mutex_lock(&this->mutex);
+        } else if (this->stopping) {
+            break;
+        } else if (this->timers.empty()) {
+            pthread_cond_wait(&this->work_cond, &this->mutex);
+        } else {
+            long long deadline = this->timers.top().deadline;
+            struct timespec until = {(time_t) (deadline / 1000000000LL), (long) (deadline % 1000000000LL)};
+            pthread_cond_timedwait(&this->work_cond, &this->mutex, &until);
+        }
+    }
+    pthread_mutex_unlock(&this->mutex);
+}
+
+void CoScheduler::drain() {
+    pthread_mutex_lock(&this->mutex);
+    while (this->live > 0) {
+        pthread_cond_wait(&this->idle_cond, &this->mutex);
+    }
+    this->stopping = true;
+    pthread_cond_broadcast(&this->work_cond);
+    pthread_mutex_unlock(&this->mutex);
+    for (auto worker : this->workers) {
+        pthread_join(worker, nullptr);
+    }
+    this->workers.clear();
+}
+
+enum waiting_policy { // order in which barbers call waiting customers (--waiting-policy)
+    waiting_fifo, waiting_shortest_service, waiting_priority
+};
+
+enum idle_policy { // which sleeping barber an arrival wakes (--idle-policy)
+    idle_fifo, idle_lifo
+};
+
+enum placement_strategy { // where barber and customer threads run (--placement)
+    placement_none, // wherever the scheduler puts them
+    placement_compact, // everyone on the first NUMA node
+    placement_split, // barbers on one set of cores, customers on another (separate nodes if there are two)
+    placement_spread // each barber on its own core, interleaved across nodes
+};
+
+// --what-if: a variant of the day, forked from the shop at the end of
+// the warm-up.  Fields left at -1 keep the shop's own value.
+struct WhatIf {
+    string label; // the --what-if argument
+    int barbers = -1; // no fewer than nbarbers: the extra barbers are hired at the fork
+    int chairs = -1;
+    int service = -1; // avg_service_time
+    int deviation = -1; // service_time_std_deviation
+    int arrival = -1; // avg_customer_arrival_time
+};
+
+// Optional features selected on the command line after the six
+// positional arguments.
+struct ShopOptions {
+    bool virtual_time = false; // run the day on a simulated clock instead of sleeping
+    int customer_workers = 0; // size of the customer thread pool (0: one thread per customer)
+    bool lock_free = false; // lock-free waiting room and idle-barber stack instead of shop_mutex
+    bool print_summary = true; // print the end-of-day counters from run()
+    bool futex_handshake = false; // atomic state word + futex instead of mutex/condvar per party
+    int shards = 1; // --shards: number of shops in a ShopCluster
+    int coroutine_workers = 0; // --coroutines: barbers and customers are coroutines on this many threads
+    ShopCluster* cluster = nullptr; // set by ShopCluster for each of its shards
+    unsigned long seed = 0; // seeds the arrival and service random streams
+    bool fixed_seed = false; // false: draw a fresh seed (reported in the summary)
+    string record_path; // write every arrival/service sample drawn to this trace
+    string event_trace_path; // --event-trace: binary record of every event_log line
+    string replay_path; // take arrival/service samples from this trace instead
+    double replicate_tolerance = 0; // --replicate: run replications until the CIs are this tight (relative)
+    string metrics_path; // --metrics: Prometheus snapshots to this file, or unix:PATH to serve them on a socket
+    int metrics_interval_ms = 1000; // --metrics-interval
+    int drain_timeout_ms = -1; // --drain-timeout: evict whoever still waits this long after closing (-1: serve everyone)
+    waiting_policy waiting = waiting_fifo; // --waiting-policy
+    int priority_classes = 3; // --waiting-policy priority: classes drawn uniformly per customer, 0 first
+    int aging_ms = 1000; // --aging: waiting this long is worth one priority class
+    idle_policy idle = idle_fifo; // --idle-policy (--lockfree is always LIFO)
+    placement_strategy placement = placement_none; // --placement
+    string barber_cpus; // --barber-cpus: cpu list such as 0-3,8 (overrides --placement for barbers)
+    string customer_cpus; // --customer-cpus
+    int customer_stack_kb = 0; // --customer-stack: customer thread stack size (0: default)
+    bool reactor = false; // --reactor: the virtual-time engine paced by the wall clock (implies virtual_time)
+    int burst = 1; // --burst: customers per arrival, admitted together by arrives_batch
+    vector<pair<int, int>> rate_schedule; // --rate-schedule: (from second, mean ms between arrivals), ascending
+    int autoscale_min = 0; // --autoscale MIN:MAX (0: a fixed staff of nbarbers)
+    int autoscale_max = 0;
+    int scale_interval_ms = 500; // --scale-interval: how often the autoscaler looks at the shop
+    int scale_up_queue = 0; // --scale-thresholds: hire when this many wait (0: half the chairs, at least 1)
+    double scale_up_turnaway = 0.05; // ... or when more than this share of the window's arrivals left
+    int scale_down_windows = 3; // retire a sleeping barber after this many quiet windows in a row
+    bool fixed_layouts = true; // false (--runtime-shop): never pick a compiled FixedShop
+    int warmup_seconds = 0; // --warmup: the day's statistics start over this far into the day
+    bool lock_profile = false; // --lock-profile: time every shop, barber, customer and rng mutex acquisition
+    vector<WhatIf> what_ifs; // --what-if: variants forked at the end of the warm-up (virtual time)
+};
+
+// Parse a sysfs-style cpu list ("0-3,8,10-11").  Returns false if the
+// list is malformed.
+bool parse_cpu_list(const string& list, vector<int>& cpus) {
+    cpus.clear();
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        string range = list.substr(start, end == string::npos ? string::npos : end - start);
+        char* rest;
+        long first = strtol(range.c_str(), &rest, 10);
+        long last = first;
+        if (rest == range.c_str()) {
+            return false;
+        }
+        if (*rest == '-') {
+            const char* from = rest + 1;
+            last = strtol(from, &rest, 10);
+            if (rest == from) {
+                return false;
+            }
+        }
+        if (*rest != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+            return false;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+        if (end == string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return !cpus.empty();
+}
+
+// The CPUs this process may run on, grouped by NUMA node from sysfs.
+// Under a restricted cpuset (taskset, a container) the nodes keep only
+// the allowed CPUs, and nodes with none left are dropped.  Without NUMA
+// information every allowed CPU is in a single node.
+struct CpuTopology {
+    vector<vector<int>> nodes;
+
+    static CpuTopology read() {
+        CpuTopology topology;
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof allowed, &allowed) != 0) {
+            perror("sched_getaffinity");
+            exit(EXIT_FAILURE);
+        }
+        for (int node = 0;; node++) {
+            string path = "/sys/devices/system/node/node" + to_string(node) + "/cpulist";
+            FILE* in = fopen(path.c_str(), "r");
+            if (in == nullptr) {
+                break;
+            }
+            char list[4096] = "";
+            vector<int> cpus;
+            if (fgets(list, sizeof list, in) != nullptr && parse_cpu_list(string(list, strcspn(list, "\n")), cpus)) {
+                cpus.erase(remove_if(cpus.begin(), cpus.end(), [&](int cpu) {
+                    return !CPU_ISSET(cpu, &allowed);
+                }), cpus.end());
+                if (!cpus.empty()) { // memory-only nodes have an empty list
+                    topology.nodes.push_back(cpus);
+                }
+            }
+            fclose(in);
+        }
+        if (topology.nodes.empty()) {
+            vector<int> cpus;
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    cpus.push_back(cpu);
+                }
+            }
+            topology.nodes.push_back(cpus);
+        }
+        return topology;
+    }
+
+    vector<int> all() const { // node by node
+        vector<int> cpus;
+        for (auto& node : this->nodes) {
+            cpus.insert(cpus.end(), node.begin(), node.end());
+        }
+        return cpus;
+    }
+};
+
+// Thread attributes that carry out --placement, --barber-cpus,
+// --customer-cpus and --customer-stack.  Threads inherit the creating
+// thread's affinity, so an empty cpu list leaves them where they are.
+class ThreadPlacement {
+public:
+    ThreadPlacement() : customer_stack(0) {
+    }
+
+    ThreadPlacement(const ShopOptions& options);
+
+    // Affinity for barber `id`'s thread.
+    void barber_attr(pthread_attr_t* attr, int id) const;
+
+    // Affinity and stack size for a customer thread (or pool worker).
+    void customer_attr(pthread_attr_t* attr) const;
+
+    // e.g. "split (barbers 0-3, customers 4-7)"
+    string describe() const;
+
+private:
+    static void set_affinity(pthread_attr_t* attr, const vector<int>& cpus);
+    static string cpu_list(const vector<int>& cpus);
+    static vector<int> available(const vector<int>& cpus, const vector<int>& all, const char* flag);
+
+    placement_strategy strategy;
+    vector<vector<int>> barber_cpus; // barber i uses barber_cpus[i % size()]; empty: unpinned
+    vector<int> customer_cpus; // empty: unpinned
+    size_t customer_stack; // bytes, 0: default
+};
+
+ThreadPlacement::ThreadPlacement(const ShopOptions& options) : strategy(options.placement) {
+    CpuTopology topology = CpuTopology::read();
+    vector<int> all = topology.all();
+    switch (options.placement) {
+        case placement_compact:
+            this->barber_cpus.push_back(topology.nodes[0]);
+            this->customer_cpus = topology.nodes[0];
+            break;
+        case placement_split:
+            if (topology.nodes.size() >= 2) { // a whole node each, so neither side crosses the interconnect
+                this->barber_cpus.push_back(topology.nodes[0]);
+                this->customer_cpus = topology.nodes[1];
+            } else if (all.size() >= 2) {
+                this->barber_cpus.push_back(vector<int>(all.begin(), all.begin() + all.size() / 2));
+                this->customer_cpus = vector<int>(all.begin() + all.size() / 2, all.end());
+            }
+            break;
+        case placement_spread:
+            // Take one core from each node in turn, so consecutive
+            // barbers land on different nodes.
+            for (size_t i = 0; this->barber_cpus.size() < all.size(); i++) {
+                for (auto& node : topology.nodes) {
+                    if (i < node.size()) {
+                        this->barber_cpus.push_back({node[i]});
+                    }
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    vector<int> cpus;
+    if (parse_cpu_list(options.barber_cpus, cpus)) {
+        this->barber_cpus.assign(1, available(cpus, all, "--barber-cpus"));
+    }
+    if (parse_cpu_list(options.customer_cpus, cpus)) {
+        this->customer_cpus = available(cpus, all, "--customer-cpus");
+    }
+    this->customer_stack = options.customer_stack_kb * 1024UL;
+}
+
+// The cpus of an explicit list that this process may use; a thread
+// pinned to none of them could not be created.
+
+vector<int> ThreadPlacement::available(const vector<int>& cpus, const vector<int>& all, const char* flag) {
+    vector<int> usable;
+    for (int cpu : cpus) {
+        if (find(all.begin(), all.end(), cpu) != all.end()) {
+            usable.push_back(cpu);
+        }
+    }
+    if (usable.empty()) {
+        cerr << flag << ": none of " << cpu_list(cpus) << " is available (available: " << cpu_list(all) << ")" << endl;
+        exit(EXIT_FAILURE);
+    }
+    return usable;
+}
+
+void ThreadPlacement::set_affinity(pthread_attr_t* attr, const vector<int>& cpus) {
+    if (cpus.empty()) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    int rc = pthread_attr_setaffinity_np(attr, sizeof set, &set);
+    if (rc != 0) {
+        errno = rc;
+        perror("setting thread affinity");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void ThreadPlacement::barber_attr(pthread_attr_t* attr, int id) const {
+    if (!this->barber_cpus.empty()) {
+        set_affinity(attr, this->barber_cpus[id % this->barber_cpus.size()]);
+    }
+}
+
+void ThreadPlacement::customer_attr(pthread_attr_t* attr) const {
+    set_affinity(attr, this->customer_cpus);
+    if (this->customer_stack > 0) {
+        int rc = pthread_attr_setstacksize(attr, max(this->customer_stack, (size_t) PTHREAD_STACK_MIN));
+        if (rc != 0) {
+            errno = rc;
+            perror("setting customer stack size");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+string ThreadPlacement::cpu_list(const vector<int>& cpus) {
+    if (cpus.empty()) {
+        return "any";
+    }
+    string list;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            j++;
+        }
+        list += (list.empty() ? "" : ",") + to_string(cpus[i]) + (j > i ? "-" + to_string(cpus[j]) : "");
+        i = j;
+    }
+    return list;
+}
+
+string ThreadPlacement::describe() const {
+    const char* names[] = {"none", "compact", "split", "spread"};
+    string barbers;
+    if (this->barber_cpus.size() > 1) {
+        barbers = "one each of ";
+        vector<int> cpus;
+        for (auto& set : this->barber_cpus) {
+            cpus.insert(cpus.end(), set.begin(), set.end());
+        }
+        barbers += cpu_list(cpus);
+    } else {
+        barbers = cpu_list(this->barber_cpus.empty() ? vector<int>() : this->barber_cpus[0]);
+    }
+    string description = string(names[this->strategy]) + " (barbers " + barbers + ", customers " + cpu_list(this->customer_cpus);
+    if (this->customer_stack > 0) {
+        description += ", customer stack " + to_string(this->customer_stack / 1024) + " KiB";
+    }
+    return description + ")";
+}
+
+// Random variates drawn a block at a time (Shop::service_time and
+// Shop::customer_arrival_time).  A refill takes a block of uniforms
+// from the stream's generator and transforms them in straight loops
+// the compiler can vectorize; each draw then just takes the next
+// value from the block.
+const int VARIATE_BLOCK = 256;
+
+// 53-bit uniform in [0, 1), or (0, 1] where a logarithm follows.
+inline double uniform_variate(mt19937_64& generator) {
+    return (generator() >> 11) * 0x1.0p-53;
+}
+
+inline double positive_uniform_variate(mt19937_64& generator) {
+    return ((generator() >> 11) + 1) * 0x1.0p-53;
+}
+
+// Normal service times (Box-Muller), truncated as before: a draw that
+// comes out below 80% of the mean after rounding down to whole
+// milliseconds is dropped and the next one taken.
+class ServiceVariates {
+public:
+    void reset(int mean, int deviation) {
+        this->mean = mean;
+        this->deviation = deviation;
+        this->next = this->count = 0; // the rest of the block had the old parameters
+    }
+
+    int draw(mt19937_64& generator) {
+        while (this->next == this->count) {
+            this->refill(generator);
+        }
+        return this->values[this->next++];
+    }
+
+private:
+    void refill(mt19937_64& generator);
+
+    int mean = 0;
+    int deviation = 0;
+    int values[VARIATE_BLOCK];
+    int next = 0;
+    int count = 0;
+};
+
+void ServiceVariates::refill(mt19937_64& generator) {
+    const int PAIRS = VARIATE_BLOCK / 2;
+    double radius[PAIRS], angle[PAIRS], z[VARIATE_BLOCK];
+    for (int i = 0; i < PAIRS; i++) {
+        radius[i] = positive_uniform_variate(generator);
+        angle[i] = uniform_variate(generator);
+    }
+    for (int i = 0; i < PAIRS; i++) {
+        double r = sqrt(-2.0 * log(radius[i]));
+        z[2 * i] = r * cos(2 * M_PI * angle[i]);
+        z[2 * i + 1] = r * sin(2 * M_PI * angle[i]);
+    }
+    double shortest = 0.8 * this->mean; // clip service time by 80% of the average
+    this->next = this->count = 0;
+    for (int i = 0; i < VARIATE_BLOCK; i++) { // keep the draws that pass, without a branch
+        int value = (int) (this->mean + this->deviation * z[i]);
+        this->values[this->count] = value;
+        this->count += value >= shortest;
+    }
+}
+
+// Poisson arrival gaps by table inversion: the CDF over the mean's
+// range (12 standard deviations either side) and a guide table that
+// maps a uniform straight to the CDF entry where the search starts,
+// so a draw takes one or two comparisons.  A --rate-schedule has a
+// few means; each gets its own table and block.
+class ArrivalVariates {
+public:
+    int draw(mt19937_64& generator, int mean) {
+        Table& table = this->tables[mean];
+        if (table.cdf.empty()) {
+            build(table, mean);
+        }
+        if (table.next == VARIATE_BLOCK) {
+            refill(table, generator);
+        }
+        return table.values[table.next++];
+    }
+
+private:
+    struct Table {
+        int first = 0; // value of cdf[0]
+        vector<double> cdf;
+        vector<int> guide; // guide[j]: first entry with cdf > j / guide.size()
+        int values[VARIATE_BLOCK];
+        int next = VARIATE_BLOCK;
+    };
+
+    static void build(Table& table, int mean);
+    static void refill(Table& table, mt19937_64& generator);
+
+    map<int, Table> tables;
+};
+
+void ArrivalVariates::build(Table& table, int mean) {
+    double spread = 12 * sqrt((double) mean) + 10;
+    int first = max(0, (int) (mean - spread));
+    int last = (int) (mean + spread);
+    // Weights relative to the mode, by the ratio p(k+1)/p(k) = mean/(k+1),
+    // so nothing underflows the way exp(-mean) would for large means.
+    vector<double> weight(last - first + 1);
+    weight[mean - first] = 1;
+    for (int k = mean; k < last; k++) {
+        weight[k + 1 - first] = weight[k - first] * mean / (k + 1);
+    }
+    for (int k = mean; k > first; k--) {
+        weight[k - 1 - first] = weight[k - first] * k / mean;
+    }
+    double total = 0;
+    for (double w : weight) {
+        total += w;
+    }
+    table.first = first;
+    table.cdf.resize(weight.size());
+    double sum = 0;
+    for (size_t i = 0; i < weight.size(); i++) {
+        sum += weight[i];
+        table.cdf[i] = sum / total;
+    }
+    table.cdf.back() = 1.0;
+    table.guide.resize(table.cdf.size());
+    size_t entry = 0;
+    for (size_t j = 0; j < table.guide.size(); j++) {
+        while (table.cdf[entry] <= (double) j / table.guide.size()) {
+            entry++;
+        }
+        table.guide[j] = entry;
+    }
+}
+
+void ArrivalVariates::refill(Table& table, mt19937_64& generator) {
+    double u[VARIATE_BLOCK];
+    for (int i = 0; i < VARIATE_BLOCK; i++) {
+        u[i] = uniform_variate(generator);
+    }
+    for (int i = 0; i < VARIATE_BLOCK; i++) {
+        size_t entry = table.guide[(size_t) (u[i] * table.guide.size())];
+        while (table.cdf[entry] <= u[i]) {
+            entry++;
+        }
+        table.values[i] = table.first + entry;
+    }
+    table.next = 0;
+}
+
+// Binary workload trace: a header followed by every arrival time and
+// then every service time drawn during a run, as 32-bit milliseconds.
+// Replaying a trace reproduces the exact same workload.
+struct WorkloadTraceHeader {
+    char magic[4]; // "BSWT"
+    uint32_t version;
+    uint32_t n_arrivals;
+    uint32_t n_services;
+};
+
+class WorkloadTrace {
+public:
+    WorkloadTrace() : mapping(nullptr), length(0), arrivals(nullptr), services(nullptr), n_arrivals(0), n_services(0) {}
+
+    ~WorkloadTrace() {
+        if (this->mapping != nullptr) {
+            munmap(this->mapping, this->length);
+        }
+    }
+
+    // Memory-map a trace written by save().
+    void map(const string& path);
+
+    static void save(const string& path, const vector<int32_t>& arrivals, const vector<int32_t>& services);
+
+    void* mapping;
+    size_t length;
+    const int32_t* arrivals;
+    const int32_t* services;
+    uint32_t n_arrivals;
+    uint32_t n_services;
+};
+
+void WorkloadTrace::map(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror(path.c_str());
+        exit(EXIT_FAILURE);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        perror(path.c_str());
+        exit(EXIT_FAILURE);
+    }
+    this->length = info.st_size;
+    if (this->length < sizeof (WorkloadTraceHeader)) {
+        cerr << path << ": not a workload trace" << endl;
+        exit(EXIT_FAILURE);
+    }
+    this->mapping = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (this->mapping == MAP_FAILED) {
+        perror(path.c_str());
+        exit(EXIT_FAILURE);
+    }
+    const WorkloadTraceHeader* header = reinterpret_cast<const WorkloadTraceHeader*> (this->mapping);
+    if (memcmp(header->magic, "BSWT", 4) != 0 || header->version != 1
+            || this->length != sizeof (WorkloadTraceHeader) + sizeof (int32_t) * ((size_t) header->n_arrivals + header->n_services)) {
+        cerr << path << ": not a workload trace" << endl;
+        exit(EXIT_FAILURE);
+    }
+    this->n_arrivals = header->n_arrivals;
+    this->n_services = header->n_services;
+    this->arrivals = reinterpret_cast<const int32_t*> (header + 1);
+    this->services = this->arrivals + this->n_arrivals;
+}
+
+void WorkloadTrace::save(const string& path, const vector<int32_t>& arrivals, const vector<int32_t>& services) {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (out == nullptr) {
+        perror(path.c_str());
+        exit(EXIT_FAILURE);
+    }
+    WorkloadTraceHeader header;
+    memcpy(header.magic, "BSWT", 4);
+    header.version = 1;
+    header.n_arrivals = arrivals.size();
+    header.n_services = services.size();
+    if (fwrite(&header, sizeof header, 1, out) != 1
+            || fwrite(arrivals.data(), sizeof (int32_t), arrivals.size(), out) != arrivals.size()
+            || fwrite(services.data(), sizeof (int32_t), services.size(), out) != services.size()
+            || fclose(out) != 0) {
+        perror(path.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Event counter that many threads bump without sharing a cache line:
+// each thread adds to one of SLOTS padded slots, and a read sums them.
+// Reads are for reports and the metrics sampler, so they may be a few
+// increments behind the writers.
+class ShardedCounter {
+public:
+    static const int SLOTS = 16;
+
+    void add(long n) {
+        this->slots[slot()].value.fetch_add(n, memory_order_relaxed);
+    }
+
+    void operator++(int) {
+        this->add(1);
+    }
+
+    void operator+=(long n) {
+        this->add(n);
+    }
+
+    long load() const {
+        long sum = 0;
+        for (const Slot& slot : this->slots) {
+            sum += slot.value.load(memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    operator int() const {
+        return (int) this->load();
+    }
+
+    void reset() {
+        for (Slot& slot : this->slots) {
+            slot.value.store(0, memory_order_relaxed);
+        }
+    }
+
+private:
+    struct alignas(64) Slot {
+        atomic<long> value{0};
+    };
+
+    static int slot() {
+        static atomic<int> next_slot{0};
+        thread_local int mine = next_slot++ % SLOTS; // threads take slots round robin
+        return mine;
+    }
+
+    Slot slots[SLOTS];
+};
+
+// --lock-profile: every acquisition of the shop's mutexes, by role.
+// shop_mutex guards admission and the waiting room, each barber and
+// customer has a handshake mutex, and rng_mutex guards the random
+// streams.
+enum lock_role {
+    shop_lock, barber_lock, customer_lock, rng_lock, N_LOCK_ROLES
+};
+
+struct LockStats {
+    ShardedCounter acquisitions;
+    ShardedCounter contended; // the mutex was already held
+    ShardedCounter wait_ns; // blocked in pthread_mutex_lock (contended acquisitions only)
+    ShardedCounter hold_ns; // from acquisition to release, not counting condition waits
+
+    void reset() {
+        this->acquisitions.reset();
+        this->contended.reset();
+        this->wait_ns.reset();
+        this->hold_ns.reset();
+    }
+};
+
+// Scoped mutex.  With LockStats the acquisition is timed: a trylock
+// tells contended from uncontended acquisitions, and the clock is read
+// only when profiling.  unlock() and lock() let a scope release the
+// mutex early and take it again; wait() is pthread_cond_wait.
+class Lock {
+public:
+
+    Lock(pthread_mutex_t* mutex, LockStats* stats = nullptr) : mutex(mutex), stats(stats), held(false) {
+        this->lock();
+    }
+
+    ~Lock() {
+        if (this->held) {
+            this->unlock();
+        }
+    }
+
+    void lock() {
+        int rc;
+        if (this->stats == nullptr) {
+            rc = pthread_mutex_lock(this->mutex);
+        } else {
+            rc = pthread_mutex_trylock(this->mutex);
+            if (rc == EBUSY) {
+                long long started = clock_ns();
+                rc = pthread_mutex_lock(this->mutex);
+                this->acquired_at = clock_ns();
+                this->stats->contended++;
+                this->stats->wait_ns += this->acquired_at - started;
+            } else {
+                this->acquired_at = clock_ns();
+            }
+            this->stats->acquisitions++;
+        }
+        if (rc != 0) {
+            errno = rc;
+            perror("can't lock mutex");
+            exit(EXIT_FAILURE);
+        }
+        this->held = true;
+    }
+
+    void unlock() {
+        this->held = false;
+        if (this->stats != nullptr) {
+            this->stats->hold_ns += clock_ns() - this->acquired_at;
+        }
+        int rc = pthread_mutex_unlock(this->mutex);
+        if (rc != 0) {
+            errno = rc;
+            perror("can't unlock mutex");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Sleeping on `cond` releases the mutex, so it does not count as
+    // holding it.
+    void wait(pthread_cond_t* cond) {
+        if (this->stats != nullptr) {
+            this->stats->hold_ns += clock_ns() - this->acquired_at;
+        }
+        pthread_cond_wait(cond, this->mutex);
+        if (this->stats != nullptr) {
+            this->acquired_at = clock_ns();
+        }
+    }
+
+private:
+    pthread_mutex_t* mutex;
+    LockStats* stats;
+    bool held;
+    long long acquired_at = 0;
+
+    static long long clock_ns() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000LL + now.tv_nsec;
+    }
+
+    Lock(const Lock&) = delete;
+};
+
+// End-of-day counters reported by Shop::run.
+struct ShopSummary {
+    int served_immediately;
+    int waited;
+    int served;
+    int turned_away;
+    int total;
+    unsigned long seed;
+    int redirected_out; // ShopCluster: full here, admitted by a neighbor instead
+    int redirected_in; // ShopCluster: admitted here after a neighbor was full
+    int stolen; // ShopCluster: customers our barbers took from a neighbor's waiting room
+    int evicted; // still waiting when the drain timeout expired; counted in waited, not served
+    double barber_seconds; // staffing cost: barbers on duty integrated over the day
+};
+
+// Closed-form M/M/c/K expectations: c barbers, K = c + chairs
+// customers in the shop at most, Poisson arrivals and exponential
+// service.  The simulator draws arrival gaps from a Poisson
+// distribution and service times from a truncated normal, so this is
+// the reference the measured numbers should approach, not match.
+struct QueueModel {
+    double blocking; // probability an arrival finds the shop full (turn-away rate)
+    double wait_ms; // expected time in the waiting room of an admitted customer
+    double utilization; // mean fraction of barbers busy
+};
+
+// Mean of the service time Shop::service_time draws: a normal
+// resampled until it reaches 80% of the mean, then truncated to whole
+// milliseconds.
+double effective_service_mean(double mean, double deviation) {
+    if (deviation <= 0) {
+        return mean;
+    }
+    double alpha = -0.2 * mean / deviation; // the 80% cut in standard units
+    double tail = 0.5 * erfc(alpha / sqrt(2.0)); // P(Z >= alpha)
+    double density = exp(-0.5 * alpha * alpha) / sqrt(2 * M_PI);
+    return mean + deviation * density / tail - 0.5;
+}
+
+QueueModel mmck_model(int barbers, int chairs, double service_ms, double arrival_ms) {
+    QueueModel model = {0, 0, 0};
+    if (barbers <= 0 || service_ms <= 0 || arrival_ms <= 0) {
+        return model;
+    }
+    int capacity = barbers + chairs;
+    double offered = service_ms / arrival_ms; // lambda / mu
+    double per_barber = offered / barbers;
+    // log of the unnormalized probability of n customers in the shop,
+    // so thousands of barbers do not overflow a^n / n!
+    vector<double> log_p(capacity + 1);
+    log_p[0] = 0;
+    for (int n = 1; n <= capacity; n++) {
+        log_p[n] = log_p[n - 1] + (n <= barbers ? log(offered / n) : log(per_barber));
+    }
+    double peak = *max_element(log_p.begin(), log_p.end());
+    double norm = 0;
+    for (int n = 0; n <= capacity; n++) {
+        norm += exp(log_p[n] - peak);
+    }
+    double queue_length = 0;
+    double busy = 0;
+    for (int n = 0; n <= capacity; n++) {
+        double p = exp(log_p[n] - peak) / norm;
+        queue_length += max(n - barbers, 0) * p;
+        busy += min(n, barbers) * p;
+    }
+    model.blocking = exp(log_p[capacity] - peak) / norm;
+    double admitted_rate = (1 - model.blocking) / arrival_ms;
+    model.wait_ms = admitted_rate > 0 ? queue_length / admitted_rate : 0; // Little's law
+    model.utilization = busy / barbers;
+    return model;
+}
+
+enum sim_event_type { // events driving the virtual-time simulation
+    customer_arrival, haircut_done, shop_closing, drain_deadline, scale_check, warmup_over
+};
+
+struct SimEvent {
+    long long time; // virtual milliseconds since the shop opened
+    unsigned long seq; // tie breaker so simultaneous events keep their scheduling order
+    sim_event_type type;
+    Barber* barber; // barber finishing a haircut (haircut_done only)
+};
+
+// Discrete-event scheduler for virtual-time runs: a priority queue of
+// timestamped events.  Popping an event advances the clock straight to
+// its timestamp, so nothing ever sleeps.
+class EventScheduler {
+public:
+    EventScheduler() : clock(0), seq(0) {}
+
+    void schedule(long long time, sim_event_type type, Barber* barber = nullptr) {
+        this->events.push({time, this->seq++, type, barber});
+    }
+
+    bool empty() const {
+        return this->events.empty();
+    }
+
+    long long next_time() const { // not empty
+        return this->events.top().time;
+    }
+
+    SimEvent pop() {
+        SimEvent event = this->events.top();
+        this->events.pop();
+        this->clock = event.time;
+        return event;
+    }
+
+    long long now() const {
+        return this->clock;
+    }
+
+private:
+    struct Later { // min-heap on (time, seq)
+        bool operator()(const SimEvent& a, const SimEvent& b) const {
+            return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+        }
+    };
+    priority_queue<SimEvent, vector<SimEvent>, Later> events;
+    long long clock;
+    unsigned long seq;
+};
+
+// Bounded lock-free MPMC ring buffer for the waiting room (Vyukov's
+// sequence-numbered cells).  Capacity is rounded up to a power of two;
+// the shop's admission counter, not the ring, enforces waiting_chairs.
+class WaitingRoomRing {
+public:
+    WaitingRoomRing(unsigned int capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        this->mask = size - 1;
+        this->cells = new Cell[size];
+        for (size_t i = 0; i < size; i++) {
+            this->cells[i].seq.store(i, memory_order_relaxed);
+        }
+        this->enqueue_pos.store(0, memory_order_relaxed);
+        this->dequeue_pos.store(0, memory_order_relaxed);
+    }
+
+    ~WaitingRoomRing() {
+        delete[] this->cells;
+    }
+
+    bool try_push(Customer* customer) {
+        size_t pos = this->enqueue_pos.load(memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &this->cells[pos & this->mask];
+            size_t seq = cell->seq.load(memory_order_acquire);
+            intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+            if (dif == 0) {
+                if (this->enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false; // full
+            } else {
+                pos = this->enqueue_pos.load(memory_order_relaxed);
+            }
+        }
+        cell->customer = customer;
+        cell->seq.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    Customer* try_pop() {
+        size_t pos = this->dequeue_pos.load(memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &this->cells[pos & this->mask];
+            size_t seq = cell->seq.load(memory_order_acquire);
+            intptr_t dif = (intptr_t) seq - (intptr_t) (pos + 1);
+            if (dif == 0) {
+                if (this->dequeue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return nullptr; // empty
+            } else {
+                pos = this->dequeue_pos.load(memory_order_relaxed);
+            }
+        }
+        Customer* customer = cell->customer;
+        cell->seq.store(pos + this->mask + 1, memory_order_release);
+        return customer;
+    }
+
+    // A slot was already reserved through the admission counter, so a
+    // transiently full ring only means a barber has claimed a customer
+    // but not yet taken it out.
+    void push(Customer* customer) {
+        while (!this->try_push(customer)) {
+            sched_yield();
+        }
+    }
+
+    // A customer was already claimed through the admission counter;
+    // wait for its push to land.
+    Customer* pop() {
+        Customer* customer;
+        while ((customer = this->try_pop()) == nullptr) {
+            sched_yield();
+        }
+        return customer;
+    }
+
+private:
+    struct Cell {
+        atomic<size_t> seq;
+        Customer* customer;
+    };
+    Cell* cells;
+    size_t mask;
+    char pad0[64]; // keep producers and consumers on separate cache lines
+    atomic<size_t> enqueue_pos;
+    char pad1[64];
+    atomic<size_t> dequeue_pos;
+    char pad2[64];
+};
+
+// Lock-free (Treiber) stack of sleeping barbers, linked by barber id.
+// The head carries a modification tag in its upper half so a barber
+// that is popped and pushed again cannot cause an ABA mistake.
+class IdleBarberStack {
+public:
+    IdleBarberStack(int n_barbers) : next(new atomic<int>[n_barbers]) {
+        this->head.store(0, memory_order_relaxed);
+    }
+
+    ~IdleBarberStack() {
+        delete[] this->next;
+    }
+
+    void push(int id) {
+        uint64_t old_head = this->head.load(memory_order_relaxed);
+        uint64_t new_head;
+        do {
+            this->next[id].store((int) (old_head & 0xffffffff) - 1, memory_order_relaxed);
+            new_head = ((old_head >> 32) + 1) << 32 | (uint64_t) (id + 1);
+        } while (!this->head.compare_exchange_weak(old_head, new_head, memory_order_release, memory_order_relaxed));
+    }
+
+    // Return the id of a sleeping barber, or -1 if the stack is empty.
+    int try_pop() {
+        uint64_t old_head = this->head.load(memory_order_acquire);
+        uint64_t new_head;
+        int id;
+        do {
+            id = (int) (old_head & 0xffffffff) - 1;
+            if (id < 0) {
+                return -1;
+            }
+            new_head = ((old_head >> 32) + 1) << 32 | (uint64_t) (this->next[id].load(memory_order_relaxed) + 1);
+        } while (!this->head.compare_exchange_weak(old_head, new_head, memory_order_acquire, memory_order_acquire));
+        return id;
+    }
+
+    // A barber was already claimed through the admission counter; wait
+    // for it to finish pushing itself.
+    int pop() {
+        int id;
+        while ((id = this->try_pop()) < 0) {
+            sched_yield();
+        }
+        return id;
+    }
+
+private:
+    atomic<int>* next;
+    atomic<uint64_t> head;
+};
+
+enum latency_metric { // per-customer latencies recorded into histograms
+    waiting_room_latency, // arrives until the barber calls the customer
+    handoff_latency, // barber awakened until the customer sits
+    service_latency, // haircut
+    total_latency, // arrives until payment accepted
+    N_LATENCY_METRICS
+};
+
+// Log-bucketed latency histogram in the style of HdrHistogram: values
+// (nanoseconds) below 128 have their own bucket, larger values share
+// 64 sub-buckets per power of two, so every bucket is within about
+// 1.5% of the values it holds.  Each histogram has a single writer
+// thread; counts are relaxed atomics so the report can read them while
+// the day is still winding down.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 7;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int MAX_VALUE_BITS = 44; // about 4.9 hours
+    static const int BUCKETS = SUB_BUCKETS + (MAX_VALUE_BITS - SUB_BUCKET_BITS) * (SUB_BUCKETS / 2);
+
+    LatencyHistogram() {
+        for (auto& count : this->counts) {
+            count.store(0, memory_order_relaxed);
+        }
+        this->max.store(0, memory_order_relaxed);
+        this->sum.store(0, memory_order_relaxed);
+    }
+
+    void record(long long value) { // single writer: no read-modify-write needed
+        uint64_t v = value < 0 ? 0 : min((uint64_t) value, ((uint64_t) 1 << MAX_VALUE_BITS) - 1);
+        atomic<uint64_t>& count = this->counts[bucket(v)];
+        count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        this->sum.store(this->sum.load(memory_order_relaxed) + v, memory_order_relaxed);
+        if (v > this->max.load(memory_order_relaxed)) {
+            this->max.store(v, memory_order_relaxed);
+        }
+    }
+
+    static int bucket(uint64_t v) {
+        if (v < (uint64_t) SUB_BUCKETS) {
+            return v;
+        }
+        int shift = (63 - __builtin_clzll(v)) - (SUB_BUCKET_BITS - 1);
+        return SUB_BUCKETS + (shift - 1) * (SUB_BUCKETS / 2) + (int) ((v >> shift) - SUB_BUCKETS / 2);
+    }
+
+    // Largest value that lands in bucket i.
+    static uint64_t highest_equivalent(int i) {
+        if (i < SUB_BUCKETS) {
+            return i;
+        }
+        int shift = (i - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 1;
+        uint64_t sub = (i - SUB_BUCKETS) % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    atomic<uint64_t> counts[BUCKETS];
+    atomic<uint64_t> max;
+    atomic<uint64_t> sum;
+};
+
+// Plain merged copy of several histograms, used for reporting.
+struct LatencySummary {
+    vector<uint64_t> counts = vector<uint64_t>(LatencyHistogram::BUCKETS);
+    uint64_t total = 0;
+    uint64_t max = 0;
+    uint64_t sum = 0;
+
+    void merge(const LatencyHistogram& histogram) {
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            uint64_t count = histogram.counts[i].load(memory_order_relaxed);
+            this->counts[i] += count;
+            this->total += count;
+        }
+        this->max = std::max(this->max, histogram.max.load(memory_order_relaxed));
+        this->sum += histogram.sum.load(memory_order_relaxed);
+    }
+
+    uint64_t percentile(double p) const {
+        uint64_t rank = (uint64_t) ceil(p / 100.0 * this->total);
+        uint64_t seen = 0;
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            seen += this->counts[i];
+            if (seen >= std::max(rank, (uint64_t) 1)) {
+                return std::min(LatencyHistogram::highest_equivalent(i), this->max);
+            }
+        }
+        return this->max;
+    }
+
+    double mean() const {
+        return this->total == 0 ? 0.0 : (double) this->sum / this->total;
+    }
+};
+
+// One histogram per latency metric, owned by one recording thread.
+struct LatencyRecorder {
+    LatencyHistogram histograms[N_LATENCY_METRICS];
+};
+
+// Recycling pool of Customer objects.  A customer who leaves goes back
+// on the free list with its mutex and condition variable still
+// initialized, and the next arrival reuses it, so once the pool has
+// grown to the peak number of customers in the shop, arrivals
+// allocate nothing.
+class CustomerPool {
+public:
+    CustomerPool() : created(0), live(0), peak(0) {
+        pthread_mutex_init(&this->free_mutex, NULL);
+        pthread_cond_init(&this->empty_cond, NULL);
+    }
+
+    ~CustomerPool();
+
+    Customer* acquire(Shop* shop, int id);
+    void release(Customer* customer);
+
+    int high_water_mark() const { // Customer objects ever allocated
+        return this->created;
+    }
+
+    int peak_live() const { // most customers in the shop at once
+        return this->peak;
+    }
+
+    // Wait until every acquired customer has been released, or until
+    // `deadline` (CLOCK_REALTIME) if one is given.  Returns true once
+    // the shop is empty.
+    bool wait_empty(const struct timespec* deadline = nullptr);
+
+private:
+    pthread_mutex_t free_mutex; // guards free_customers and created
+    pthread_cond_t empty_cond; // live dropped to zero
+    vector<Customer*> free_customers;
+    int created;
+    atomic<int> live;
+    atomic<int> peak;
+};
+
+// Fixed-size pool of customer threads.  Shop::run hands each arriving
+// customer to the pool instead of creating (and detaching) a thread
+// per arrival; an idle worker picks it up and runs it to completion.
+class CustomerWorkers {
+public:
+    CustomerWorkers(int n_workers, const pthread_attr_t* attr = nullptr);
+
+    // Queue an arriving customer; any idle worker will run it.
+    void submit(Customer* customer);
+
+    // Let the workers finish every queued customer, then join them.
+    void shutdown();
+
+private:
+    static void* run_worker(void* arg);
+    void work();
+
+    vector<pthread_t> workers;
+    queue<Customer*> tasks;
+    pthread_mutex_t tasks_mutex;
+    pthread_cond_t tasks_cond;
+    bool stopping;
+};
+
+// --reactor: paces the virtual-time engine with the wall clock.  The
+// shop thread sleeps in epoll_wait on a single timerfd armed for the
+// earliest pending event, so arrivals, haircut completions and closing
+// are all timers on one thread, however many barbers and chairs there
+// are.
+class Reactor {
+public:
+    Reactor();
+    ~Reactor();
+
+    // Event time 0 is now.
+    void start();
+
+    // Block until `ms` milliseconds after start() (at once if that has
+    // passed), and record how late the wakeup was.
+    void wait_until(long long ms);
+
+    LatencyHistogram lag; // nanoseconds past each event's due time
+    unsigned long wakeups = 0; // times the thread actually slept
+
+private:
+    static long long now() { // CLOCK_MONOTONIC (steady_clock), the timerfd's clock
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int epoll_fd;
+    int timer_fd;
+    long long origin; // now() at start()
+};
+
+class Shop {
+public:
+    atomic<bool> shop_open{false};
+
+    struct BarberOrWait {
+        Barber* barber; // Barber is available
+        bool chair_available; // If barber isn't available,
+        // waiting chair is available.
+    };
+
+    // Constructor initializes shop and creates the Barbers; they start
+    // work when the shop opens.
+    Shop(int n_barbers,
+            unsigned int waiting_chairs,
+            int average_service_time,
+            int service_time_deviation,
+            int average_customer_arrival,
+            int duration,
+            ShopOptions options = ShopOptions());
+    virtual ~Shop();
+
+    // A FixedShop when (n_barbers, waiting_chairs) is one of the
+    // compiled layouts and the options allow it, otherwise a Shop.
+    static Shop* create(int n_barbers,
+            unsigned int waiting_chairs,
+            int average_service_time,
+            int service_time_deviation,
+            int average_customer_arrival,
+            int duration,
+            ShopOptions options = ShopOptions());
+
+    // Main thread: open the shop and spawn customer threads until
+    // closing time, then drain.  Report summary statistics for the
+    // day.  A drained shop can run() again.
+    void run();
+
+    // Start a day: reset the counters and the waiting room and start
+    // the barbers (threads, coroutines, or naps in virtual time), who
+    // will immediately start calling next_customer to fill the
+    // collection of sleeping barbers.  run() opens the shop if needed.
+    void open();
+
+    // Closing: stop admissions, let the barbers serve the waiting
+    // room (evicting whoever is left after --drain-timeout), wait for
+    // every customer to leave and join every barber.
+    void drain();
+
+    // Counters for the day (complete once run() has returned).
+    ShopSummary summary() const;
+
+    // Customer thread announces arrival to shop. If the collection of
+    // currently sleeping barbers is not empty, remove and return one
+    // barber from the collection. If all the barbers are busy and there
+    // is an empty chair in the waiting room, add the customer to the
+    // waiting queue and return {nullptr, true}.  Otherwise, the
+    // customer will leave: return {nullptr, false}.
+    virtual BarberOrWait arrives(Customer* customer);
+
+    // A group of customers arrives at once (--burst).  They are matched
+    // against sleeping barbers and free chairs in order, under a single
+    // shop_mutex acquisition; outcomes[i] is what arrives() would have
+    // returned to customers[i].  The caller owns outcomes, so a buffer
+    // reused across batches allocates nothing.
+    void arrives_batch(const vector<Customer*>& customers, vector<BarberOrWait>& outcomes);
+
+    // Barber thread requests next customer.  If no customers are
+    // currently waiting, add the barber to the collection of
+    // currently sleeping barbers and return nullptr.
+    virtual Customer* next_customer(Barber* barber);
+
+    // Return random service time
+    int service_time();
+    int service_time(const Customer* customer); // the customer's pre-drawn time, if any
+
+    // Return random customer arrival.
+    int customer_arrival_time();
+
+    // Current time in nanoseconds: the simulated clock in virtual-time
+    // mode, otherwise the monotonic clock.
+    long long now() const;
+
+    // Record a latency into the calling thread's histograms (no lock
+    // after the thread's first sample for this shop).
+    void record(latency_metric metric, long long nanoseconds);
+
+    // Merge every thread's histogram for one metric.
+    LatencySummary latency(latency_metric metric);
+
+    // Histograms allocated for the day so far: one per thread that
+    // recorded a sample for this shop.
+    size_t recorder_count();
+
+    // ShopCluster support.  Customers currently waiting and barbers
+    // currently asleep (a snapshot, used to pick the least-loaded
+    // neighbor); take_waiting hands one waiting customer to a barber
+    // from another shard, or returns nullptr.
+    int waiting_customers() const;
+
+    // Barbers bracket each haircut with these; in_service() is the
+    // number of haircuts under way (metrics sampler).
+    void service_started() {
+        this->services_started++;
+    }
+
+    void service_finished() {
+        this->services_finished++;
+    }
+
+    int in_service() const {
+        return (int) (this->services_started.load() - this->services_finished.load());
+    }
+
+    int sleeping_barber_count() const;
+    int barbers_on_duty() const {
+        return this->staffed;
+    }
+    Customer* take_waiting();
+
+    // Stop admissions and send every sleeping barber home.  run()
+    // calls this at closing time; the benchmark calls it directly.
+    void close();
+
+    // A customer has left the shop; recycle the Customer object.
+    void release_customer(Customer* customer);
+
+    // --coroutines: the scheduler barbers and customers run on.
+    CoScheduler* coroutine_scheduler() const {
+        return this->coroutines;
+    }
+
+    const ShopOptions& settings() const {
+        return this->options;
+    }
+
+    // Where a Lock on a mutex of this role records itself: nullptr
+    // unless --lock-profile.
+    LockStats* lock_stats(lock_role role) {
+        return this->options.lock_profile ? &this->lock_profiles[role] : nullptr;
+    }
+    //pthread_cond_t * cond_barber; //array
+    //pthread_cond_t * cond_customer;
+
+    pthread_mutex_t* shop_mutex;
+    pthread_mutex_t* nextcustomer_mutex;
+
+protected:
+    // Empty waiting room and no sleeping barbers, for a new day
+    // (shop_mutex held).  FixedShop clears its embedded rings instead.
+    virtual void reset_rooms();
+    virtual string layout() const; // for the report
+
+    vector<pthread_t*> barber_threads; // by barber id; nullptr while off duty
+    vector<Barber*> barbers; // everyone the shop may employ (--autoscale MAX of them)
+    struct timespec time_limit;
+    ShardedCounter customers_served_immediately;
+    ShardedCounter customers_waited;
+    ShardedCounter customers_turned_away;
+    ShardedCounter customers_total;
+    ShardedCounter services_started;
+    ShardedCounter services_finished;
+    WaitingRoom* chairs = nullptr; // ordered by options.waiting
+    IdleBarbers* sleeping_barbers = nullptr; // ordered by options.idle
+    int average_customer_arrival;
+    int service_time_deviation;
+    int average_service_time;
+    int n_barbers;
+    //Barber* barbers_array;
+    unsigned int waiting_chairs; // should be unsigned 
+    int duration;
+    ShopOptions options;
+    EventScheduler scheduler; // virtual-time mode only
+
+    // Random streams live as long as the shop.  Arrivals are drawn only
+    // by the Shop thread; service times by every barber, under rng_mutex.
+    mt19937_64 arrival_generator;
+    mt19937_64 service_generator;
+    mt19937_64 class_generator; // --waiting-policy priority
+    ArrivalVariates arrival_variates;
+    ServiceVariates service_variates;
+    pthread_mutex_t rng_mutex;
+    vector<int32_t> recorded_arrivals; // --record
+    vector<int32_t> recorded_services;
+    WorkloadTrace replay; // --replay
+    uint32_t replayed_arrivals = 0;
+    uint32_t replayed_services = 0; // under rng_mutex
+    atomic<unsigned long> unreplayed_samples{0}; // drawn from the generators after the trace ran out (--replay only)
+    void save_trace();
+    CustomerPool customer_pool;
+    vector<Customer*> arrival_group; // --burst: the group arriving now, reused by every arrival (shop thread)
+    vector<BarberOrWait> arrival_outcomes;
+
+    // Per-thread latency histograms, registered on first use.
+    atomic<unsigned long> generation; // tells shops (and days) apart in thread-local caches
+    vector<LatencyRecorder*> recorders;
+    vector<LatencyRecorder*> warmup_recorders; // replaced at the end of the warm-up; threads may still hold them
+    pthread_mutex_t recorders_mutex;
+    static atomic<unsigned long> generations;
+    CustomerWorkers* customer_workers = nullptr; // --pool only
+    CoScheduler* coroutines = nullptr; // --coroutines only
+    Reactor* reactor = nullptr; // --reactor only
+    ThreadPlacement placement; // --placement and friends
+
+    // Lock-free mode (--lockfree): instead of the two queues under
+    // shop_mutex, a single atomic admission word holds the closed flag
+    // and a balance that is positive for customers in waiting chairs
+    // and negative for sleeping barbers.  Every admission, turn-away and
+    // nap decision is one CAS on that word; the ring and stack only
+    // carry the matching Customer/Barber.
+    WaitingRoomRing* waiting_ring = nullptr;
+    IdleBarberStack* idle_barbers = nullptr;
+    atomic<uint64_t> admission{0};
+    static const uint64_t ADMISSION_CLOSED = 1ULL << 32;
+    BarberOrWait arrives_lock_free(Customer* customer, bool redirected);
+    Customer* next_customer_lock_free(Barber* barber);
+
+    // Admission proper.  A customer redirected from a full neighbor
+    // (redirected == true) is not redirected again, and if this shop is
+    // full as well the neighbor counts the turn-away.
+    friend class ShopCluster;
+    BarberOrWait admit(Customer* customer, bool redirected);
+    BarberOrWait turn_away(Customer* customer, bool redirected, bool closed);
+    void prepare_arrival(Customer* customer); // arrival time and the priority class the waiting room orders by
+    void estimate_service(Customer* customer); // sjf: the service time, drawn as the customer takes a chair
+    void dispatch(Customer* customer, const pthread_attr_t* attr); // start a customer thread, worker or coroutine
+    ShardedCounter admission_locks; // shop_mutex acquisitions by arrives and arrives_batch
+    LockStats lock_profiles[N_LOCK_ROLES]; // --lock-profile
+    void report_locks(double day_seconds);
+    Customer* take_waiting_locked(); // shop_mutex held
+    atomic<int> queue_depth{0}; // mutex mode: chairs.size(), readable without the lock
+    atomic<int> sleeping_count{0}; // mutex mode: sleeping_barbers.size()
+    ShardedCounter customers_redirected_out;
+    ShardedCounter customers_redirected_in;
+    ShardedCounter customers_stolen;
+    ShardedCounter customers_evicted;
+    long long opened_at = 0; // now() when the day started
+    long long measured_from = 0; // now() when the statistics (re)started: opened_at, or the end of the warm-up
+    long long closed_at = 0; // now() at closing time
+    long long drained_at = 0; // now() once the last customer left
+    int waiting_at_close = 0; // in-flight work when admissions stopped
+    int in_service_at_close = 0;
+
+    // Staffing.  n_barbers start the day; with --autoscale, hire()
+    // puts another barber on duty and retire() sends a sleeping one
+    // home, driven by autoscale() every --scale-interval.
+    vector<char> on_duty; // by barber id
+    atomic<int> staffed{0};
+    int peak_staffed = 0;
+    int hires = 0;
+    int retirements = 0;
+    long long barber_ns = 0; // barbers on duty integrated up to staffing_changed_at
+    long long staffing_changed_at = 0;
+    unsigned long window_total = 0; // autoscaler: counters at the previous check
+    unsigned long window_turned_away = 0;
+    int quiet_windows = 0;
+    mutable pthread_mutex_t staffing_mutex; // barber_ns and staffing_changed_at (the scaler thread hires and retires)
+    int scaler_wakeup = -1; // threaded autoscaler: eventfd that stops it
+    pthread_t scaler;
+    void start_barber(Barber* barber); // thread, or a nap in virtual time
+    void staffing_changed(int delta);
+    double barber_seconds() const; // barbers on duty integrated over the day so far
+    atomic<double> day_barber_seconds{0}; // the day's total, once drained (what summary() reports)
+    void autoscale();
+    void hire();
+    void retire();
+    static void* run_scaler(void* arg);
+    int arrival_mean(); // --rate-schedule: mean ms between arrivals right now
+
+    // Warm-up (--warmup).  end_warmup() starts the counters, histograms
+    // and barber-seconds over, so the report covers only the rest of
+    // the day.
+    bool warming_up = false;
+    int warmup_arrivals = 0; // customers who arrived during the warm-up
+    void end_warmup();
+
+    // What-if variants (--what-if, virtual time).  At the end of the
+    // warm-up the shop forks one process per variant; each child
+    // changes its copy of the shop (queues, barbers, customers, random
+    // streams and clock are as the parent left them) and finishes the
+    // day, then sends its summary back over a pipe.
+    struct WhatIfResult {
+        ShopSummary summary;
+        double wait_mean_ms;
+        double wait_p99_ms;
+    };
+    struct WhatIfChild {
+        pid_t pid;
+        int result_fd;
+    };
+    vector<WhatIfChild> what_if_children;
+    int what_if_result_fd = -1; // in a child: where its result goes
+    void fork_what_ifs();
+    void apply(const WhatIf& what_if);
+    WhatIfResult what_if_result();
+    void report_what_ifs();
+
+    void cleanup();
+
+    // Virtual-time mode: replay the day on the event scheduler,
+    // driving the same arrives/next_customer/awaken/customer_sits/
+    // payment protocol from a single thread.
+    void run_virtual();
+    static long long virtual_clock(const void* shop); // event_log timestamps in virtual time
+    void virtual_arrival(int customer_id);
+    void virtual_haircut_done(Barber* barber);
+    void virtual_closing();
+    void virtual_drain_deadline(); // --drain-timeout: evict whoever is still waiting
+    void virtual_haircut(Barber* barber, Customer* customer);
+    void report();
+};
+
+class Barber {
+public:
+    bool gohome; // boolean to mark if it is time for the barber to go home after being sleeping
+    bool givinghaircut; // boolean to control the barber status
+    bool hassitting; // boolean to control barber status, has a customer sitting on the chair so he should start serving
+    bool gotpaid; // boolean to control barber status, whether he got paid or not
+
+    Barber(Shop* shop, int id);
+
+    // Barber thread function.
+    void run();
+
+    // Shop tells barber it's closing time.
+    void closing_time();
+
+    // Customer wakes up barber.
+    void awaken(Customer* customer);
+
+    // Customer sits in barber's chair.
+    void customer_sits();
+
+    // Customer proffers payment.
+    void payment();
+
+    // Customer currently assigned to this barber (nullptr if none).
+    Customer* customer() const;
+
+    // Clear the per-haircut flags once the customer has left.
+    void reset();
+
+    /*const*/ int id = 0;
+
+    long long awakened_at; // when the current customer woke the barber (latency histograms)
+    long long seated_at; // when the current customer sat down
+
+private:
+    // --futex: the barber's handshake state (handshake_state), set by
+    // the customer and the shop, waited on by the barber.
+    atomic<int> state;
+    void run_futex();
+    void cut_hair(); // usleep for a random service time
+    void post(int state); // store a new handshake state and wake the barber
+    CoEvent wake_event; // --coroutines: resumes co_run when state changes
+public:
+    // --coroutines: the barber as a coroutine; waits are co_awaits on
+    // wake_event and the haircut is a scheduler timer.
+    CoTask co_run();
+private:
+    Customer* myCustomer; // a barber has a customer
+    pthread_cond_t* cond_barber; // cond variable for the barber
+    pthread_mutex_t* barber_mutex; // barber mutex
+    barber_status barber_state; // each barber has a state from the enums but it is not used
+    Shop* shop;
+
+    Barber(const Barber&) = delete;
+};
+
+class Customer {
+public:
+    bool awakenedbarber; // a boolean to control Customer states, customer awakened the barber
+    bool hadhaircut; // a boolean to control if a customer has had his haircut
+    bool paid; // a boolean to control if the customer paid the barber or not
+    bool evicted; // the shop closed before a barber called him
+    
+    Customer();
+    Customer(Shop* shop, int id);
+    ~Customer();
+
+    // Prepare a recycled Customer for a new arrival.
+    void reuse(Shop* shop, int id);
+
+    Shop* shop_of() const {
+        return this->shop;
+    }
+
+    void run();
+
+    // Barber calls this customer after checking the waiting-room
+    // queue (customer should be waitint).
+    void next_customer(Barber* barber);
+
+    // Barber finishes haircut (Customer should be receiving haircut).
+    void finished();
+
+    // Barber has accepted payment for service.
+    void payment_accepted();
+
+    // Shop admitted this customer with arrives_batch before he started;
+    // run() acts on `outcome` instead of calling arrives() itself.
+    void admitted(Shop::BarberOrWait outcome);
+
+    // Shop drains the waiting room at closing: leave without a haircut
+    // (Customer should be waiting).
+    void evict();
+
+    /*const*/ int id /*= 0*/;
+
+private:
+    Shop* shop;
+    Barber* myBarber; // a customer has a barber to serve him
+    // --futex: the customer's handshake state (handshake_state), set by
+    // the barber, waited on by the customer.
+    atomic<int> state;
+    void run_futex();
+    void post(int state); // store a new handshake state and wake the customer
+    Shop::BarberOrWait enter(); // arrives(), or the outcome of arrives_batch
+    bool preadmitted; // --burst: admission holds the outcome
+    Shop::BarberOrWait admission;
+    CoEvent wake_event; // --coroutines: resumes co_run when state changes
+    atomic<int> holds; // --coroutines: co_run and the barber's last post; the last to let go recycles
+    void leave();
+public:
+    // --coroutines: the customer as a coroutine.  Returns the Customer
+    // to the pool when he leaves.
+    CoTask co_run();
+    long long arrived_at; // when the customer entered the shop (latency histograms)
+    long long called_at; // when a barber called the customer
+    int service_ms; // drawn on taking a chair for --waiting-policy sjf (-1: drawn when the haircut starts)
+    int priority; // --waiting-policy priority: class, 0 highest
+private:
+    pthread_cond_t* cond_customer; // conditional variable for the customer
+    pthread_mutex_t* customer_mutex; // mutex for the customer
+    customer_status customer_state; // customer enum
+    // Customer thread function.
+
+    Customer(const Customer&) = delete; // to prevent calling copy constructor
+
+};
+
+// Waiting-room ordering (--waiting-policy), guarded by shop_mutex.
+// pop() returns the customer the next free barber should call.
+class WaitingRoom {
+public:
+    virtual ~WaitingRoom() {
+    }
+
+    virtual void push(Customer* customer) = 0;
+    virtual Customer* pop() = 0; // the room is not empty
+    virtual size_t size() const = 0;
+
+    bool empty() const {
+        return this->size() == 0;
+    }
+
+    static WaitingRoom* create(const ShopOptions& options);
+};
+
+// First come, first served (the original chairs queue).
+class FifoWaitingRoom : public WaitingRoom {
+public:
+    void push(Customer* customer) override {
+        this->customers.push(customer);
+    }
+
+    Customer* pop() override {
+        Customer* customer = this->customers.front();
+        this->customers.pop();
+        return customer;
+    }
+
+    size_t size() const override {
+        return this->customers.size();
+    }
+
+private:
+    queue<Customer*> customers;
+};
+
+// Smallest key first, ties in arrival order.  The key is fixed when
+// the customer sits down.
+class KeyedWaitingRoom : public WaitingRoom {
+public:
+    void push(Customer* customer) override {
+        this->customers.push({this->key(customer), this->seq++, customer});
+    }
+
+    Customer* pop() override {
+        Customer* customer = this->customers.top().customer;
+        this->customers.pop();
+        return customer;
+    }
+
+    size_t size() const override {
+        return this->customers.size();
+    }
+
+protected:
+    virtual long long key(const Customer* customer) const = 0;
+
+private:
+    struct Seat {
+        long long key;
+        unsigned long seq;
+        Customer* customer;
+        bool operator>(const Seat& other) const {
+            return this->key != other.key ? this->key > other.key : this->seq > other.seq;
+        }
+    };
+    priority_queue<Seat, vector<Seat>, greater<Seat>> customers;
+    unsigned long seq = 0;
+};
+
+// Shortest expected service first, using the service time drawn for
+// the customer when he arrived.
+class ShortestServiceWaitingRoom : public KeyedWaitingRoom {
+protected:
+    long long key(const Customer* customer) const override {
+        return customer->service_ms;
+    }
+};
+
+// Priority classes with aging: a customer's class counts for
+// aging_ms of waiting, so the effective priority class - waited /
+// aging_ms orders exactly like arrived_at + class * aging_ms and no
+// one starves.
+class PriorityWaitingRoom : public KeyedWaitingRoom {
+public:
+    PriorityWaitingRoom(int aging_ms) : aging_ns(aging_ms * 1000000LL) {
+    }
+
+protected:
+    long long key(const Customer* customer) const override {
+        return customer->arrived_at + customer->priority * this->aging_ns;
+    }
+
+private:
+    long long aging_ns;
+};
+
+WaitingRoom* WaitingRoom::create(const ShopOptions& options) {
+    switch (options.waiting) {
+        case waiting_shortest_service:
+            return new ShortestServiceWaitingRoom();
+        case waiting_priority:
+            return new PriorityWaitingRoom(options.aging_ms);
+        default:
+            return new FifoWaitingRoom();
+    }
+}
+
+// Sleeping barbers (--idle-policy), guarded by shop_mutex.  FIFO wakes
+// the barber who has slept longest; LIFO wakes the one who went to
+// sleep last, whose thread is most likely still cache-warm.
+class IdleBarbers {
+public:
+    virtual ~IdleBarbers() {
+    }
+
+    virtual void push(Barber* barber) = 0;
+    virtual Barber* pop() = 0; // at least one barber is asleep
+    virtual size_t size() const = 0;
+
+    bool empty() const {
+        return this->size() == 0;
+    }
+
+    static IdleBarbers* create(const ShopOptions& options);
+};
+
+class DequeIdleBarbers : public IdleBarbers {
+public:
+    DequeIdleBarbers(idle_policy policy) : lifo(policy == idle_lifo) {
+    }
+
+    void push(Barber* barber) override {
+        this->barbers.push_back(barber);
+    }
+
+    Barber* pop() override {
+        Barber* barber;
+        if (this->lifo) {
+            barber = this->barbers.back();
+            this->barbers.pop_back();
+        } else {
+            barber = this->barbers.front();
+            this->barbers.pop_front();
+        }
+        return barber;
+    }
+
+    size_t size() const override {
+        return this->barbers.size();
+    }
+
+private:
+    bool lifo;
+    deque<Barber*> barbers;
+};
+
+IdleBarbers* IdleBarbers::create(const ShopOptions& options) {
+    return new DequeIdleBarbers(options.idle);
+}
+
+// Fixed-capacity rooms for FixedShop: rings in a std::array, never
+// allocating.  The capacity is the shop's compile-time chair or barber
+// count, which FixedShop checks before every push.
+template <int N>
+class FixedWaitingRoom final : public WaitingRoom {
+public:
+    void push(Customer* customer) override {
+        this->customers[(this->head + this->count++) % CAPACITY] = customer;
+    }
+
+    Customer* pop() override {
+        Customer* customer = this->customers[this->head];
+        this->head = (this->head + 1) % CAPACITY;
+        this->count--;
+        return customer;
+    }
+
+    size_t size() const override {
+        return this->count;
+    }
+
+    void clear() {
+        this->head = 0;
+        this->count = 0;
+    }
+
+private:
+    static constexpr size_t CAPACITY = N > 0 ? N : 1;
+    array<Customer*, CAPACITY> customers;
+    size_t head = 0;
+    size_t count = 0;
+};
+
+template <int N>
+class FixedIdleBarbers final : public IdleBarbers {
+public:
+    FixedIdleBarbers(idle_policy policy) : lifo(policy == idle_lifo) {
+    }
+
+    void push(Barber* barber) override {
+        this->barbers[(this->head + this->count++) % CAPACITY] = barber;
+    }
+
+    Barber* pop() override {
+        if (this->lifo) {
+            return this->barbers[(this->head + --this->count) % CAPACITY];
+        }
+        Barber* barber = this->barbers[this->head];
+        this->head = (this->head + 1) % CAPACITY;
+        this->count--;
+        return barber;
+    }
+
+    size_t size() const override {
+        return this->count;
+    }
+
+    void clear() {
+        this->head = 0;
+        this->count = 0;
+    }
+
+private:
+    static constexpr size_t CAPACITY = N > 0 ? N : 1;
+    bool lifo;
+    array<Barber*, CAPACITY> barbers;
+    size_t head = 0;
+    size_t count = 0;
+};
+
+// Whether a day with these options can run on a FixedShop: the mutex
+// admission path with a FIFO waiting room, a fixed staff and fixed chairs.
+bool fixed_layout_supported(const ShopOptions& options) {
+    return !options.lock_free && options.waiting == waiting_fifo && options.cluster == nullptr
+            && options.shards <= 1 && options.autoscale_max == 0 && options.what_ifs.empty();
+}
+
+// A Shop specialized at compile time for NBarbers barbers and NChairs
+// waiting chairs.  The waiting room and the sleeping barbers are
+// fixed-capacity rings embedded in the shop, the barbers live in one
+// contiguous array of cache-line-sized slots, and arrives() and
+// next_customer() call the rings directly (no virtual dispatch) and
+// test the capacity against constants.  The rest of the day (threads,
+// handshakes, virtual time, reporting) is the runtime Shop's.
+//
+// Shop::create builds one only when fixed_layout_supported(), and
+// falls back to a runtime Shop otherwise.
+template <int NBarbers, int NChairs>
+class FixedShop : public Shop {
+public:
+    static_assert(NBarbers >= 0 && NChairs >= 0, "a shop cannot have a negative number of barbers or chairs");
+
+    FixedShop(int average_service_time,
+            int service_time_deviation,
+            int average_customer_arrival,
+            int duration,
+            ShopOptions options = ShopOptions())
+    : Shop(NBarbers, NChairs, average_service_time, service_time_deviation, average_customer_arrival, duration, options),
+    sleepers(options.idle) {
+        assert(fixed_layout_supported(options));
+        // The runtime constructor has already staffed the shop; move the
+        // barbers into the slots and the rooms into the shop.
+        delete this->chairs;
+        delete this->sleeping_barbers;
+        this->chairs = &this->room;
+        this->sleeping_barbers = &this->sleepers;
+        for (int i = 0; i < NBarbers; i++) {
+            delete this->barbers[i];
+            this->barbers[i] = new (&this->slots[i]) Barber(this, i);
+        }
+    }
+
+    ~FixedShop() override {
+        for (auto barber : this->barbers) {
+            barber->~Barber();
+        }
+        this->barbers.clear(); // not ~Shop's to delete
+        this->chairs = nullptr;
+        this->sleeping_barbers = nullptr;
+    }
+
+    BarberOrWait arrives(Customer* customer) override {
+        this->prepare_arrival(customer);
+        Lock lock(this->shop_mutex, this->lock_stats(shop_lock));
+        this->admission_locks++;
+        if (!this->shop_open) {
+            lock.unlock();
+            return this->turn_away(customer, false, true);
+        }
+        if constexpr (NBarbers > 0) {
+            if (!this->sleepers.empty()) {
+                Barber* barber = this->sleepers.pop();
+                this->sleeping_count--;
+                this->customers_served_immediately++;
+                lock.unlock();
+                return {barber, true};
+            }
+        }
+        if constexpr (NChairs > 0) {
+            if (this->room.size() < (size_t) NChairs) {
+                event_log.log(customer_takes_seat, customer->id);
+                this->room.push(customer);
+                this->queue_depth++;
+                this->customers_waited++;
+                lock.unlock();
+                return {nullptr, true};
+            }
+        }
+        lock.unlock();
+        return this->turn_away(customer, false, false);
+    }
+
+    Customer* next_customer(Barber* barber) override {
+        Lock lock(this->shop_mutex, this->lock_stats(shop_lock));
+        if (!this->room.empty()) {
+            Customer* customer = this->room.pop();
+            this->queue_depth--;
+            barber->awaken(customer);
+            lock.unlock();
+            return customer;
+        }
+        this->sleepers.push(barber);
+        this->sleeping_count++;
+        lock.unlock();
+        return nullptr;
+    }
+
+protected:
+    void reset_rooms() override {
+        this->room.clear();
+        this->sleepers.clear();
+    }
+
+    string layout() const override {
+        return "fixed, " + to_string(NBarbers) + " barbers x " + to_string(NChairs) + " chairs";
+    }
+
+private:
+    struct alignas(64) BarberSlot { // one cache line (or more) per barber
+        unsigned char bytes[sizeof (Barber)];
+    };
+    FixedWaitingRoom<NChairs> room;
+    FixedIdleBarbers<NBarbers> sleepers;
+    array<BarberSlot, NBarbers> slots;
+};
+
+// The layouts compiled in: Run.sh's range (2-3 barbers, 1-7 chairs).
+
+template <int NBarbers, int NChairs>
+Shop* create_fixed_shop(int average_service_time, int service_time_deviation,
+        int average_customer_arrival, int duration, const ShopOptions& options) {
+    return new FixedShop<NBarbers, NChairs>(average_service_time, service_time_deviation,
+            average_customer_arrival, duration, options);
+}
+
+struct FixedShopLayout {
+    int barbers;
+    unsigned int chairs;
+    Shop* (*create)(int, int, int, int, const ShopOptions&);
+};
+
+const FixedShopLayout FIXED_SHOP_LAYOUTS[] = {
+    {2, 1, create_fixed_shop<2, 1>}, {2, 2, create_fixed_shop<2, 2>}, {2, 3, create_fixed_shop<2, 3>},
+    {2, 4, create_fixed_shop<2, 4>}, {2, 5, create_fixed_shop<2, 5>}, {2, 6, create_fixed_shop<2, 6>},
+    {2, 7, create_fixed_shop<2, 7>},
+    {3, 1, create_fixed_shop<3, 1>}, {3, 2, create_fixed_shop<3, 2>}, {3, 3, create_fixed_shop<3, 3>},
+    {3, 4, create_fixed_shop<3, 4>}, {3, 5, create_fixed_shop<3, 5>}, {3, 6, create_fixed_shop<3, 6>},
+    {3, 7, create_fixed_shop<3, 7>},
+};
+
+Shop* Shop::create(int n_barbers,
+        unsigned int waiting_chairs,
+        int average_service_time,
+        int service_time_deviation,
+        int average_customer_arrival,
+        int duration,
+        ShopOptions options) {
+    if (options.fixed_layouts && fixed_layout_supported(options)) {
+        for (const FixedShopLayout& layout : FIXED_SHOP_LAYOUTS) {
+            if (layout.barbers == n_barbers && layout.chairs == waiting_chairs) {
+                return layout.create(average_service_time, service_time_deviation,
+                        average_customer_arrival, duration, options);
+            }
+        }
+    }
+    return new Shop(n_barbers, waiting_chairs, average_service_time, service_time_deviation,
+            average_customer_arrival, duration, options);
+}
+
+// --metrics: a sampler thread that renders the counters and gauges of
+// one or more shops in Prometheus text format every interval, while
+// the day is in progress.  The snapshot either replaces a file
+// (textfile-collector style, via rename) or is served to every client
+// that connects to a Unix-domain socket.
+class MetricsExporter {
+public:
+    MetricsExporter() : started(false), listener(-1), wakeup(-1) {
+    }
+
+    ~MetricsExporter() {
+        this->stop();
+    }
+
+    // `target` is a file path or unix:PATH; shops are labelled by index.
+    void start(const string& target, int interval_ms, const vector<Shop*>& shops);
+
+    // Publish a final snapshot and stop the sampler (no-op if never started).
+    void stop();
+
+private:
+    static void* run_sampler(void* arg);
+    void sample();
+    string snapshot() const;
+    void publish(const string& text);
+
+    bool started;
+    string path;
+    bool socket_mode;
+    int interval_ms;
+    vector<Shop*> shops;
+    int listener; // socket mode: listening Unix-domain socket
+    int wakeup; // eventfd that tells the sampler to stop
+    pthread_t sampler;
+};
+
+// Several shops (shards) running side by side, each on its own core.
+// A customer who finds his shard full is redirected to the neighbor
+// with the fewest waiting customers, and a barber with nobody waiting
+// steals from the neighbor with the most, before either gives up.
+class ShopCluster {
+public:
+    ShopCluster(int n_barbers,
+            unsigned int waiting_chairs,
+            int average_service_time,
+            int service_time_deviation,
+            int average_customer_arrival,
+            int duration,
+            ShopOptions options);
+
+    // Run every shard's day concurrently and report per shard and in
+    // aggregate.
+    void run();
+
+    // Admit a customer turned away by `from` at its least-loaded
+    // neighbor, counting the outcome there.
+    Shop::BarberOrWait redirect(Shop* from, Customer* customer);
+
+    // Take a waiting customer from the busiest neighbor of `thief`.
+    Customer* steal(Shop* thief);
+
+    // Latency recorders allocated by every shard (after run()).
+    size_t recorder_count();
+
+private:
+    struct Shard {
+        ShopCluster* cluster;
+        int index;
+        Shop* shop;
+    };
+    static void* run_shard(void* arg);
+
+    int n_barbers;
+    unsigned int waiting_chairs;
+    int average_service_time;
+    int service_time_deviation;
+    int average_customer_arrival;
+    int duration;
+    ShopOptions options;
+    vector<Shard> shards;
+    pthread_barrier_t opened; // every shard constructed before any opens
+    atomic<bool> ready{false}; // shards[] may be read by other shards
+    MetricsExporter metrics; // --metrics: one exporter labels every shard
+};
+
+Barber::Barber(Shop* shop, int id) {
+    this->gotpaid=false; // setting all conditions ti false
+    this->givinghaircut=false;
+    this->hassitting=false;
+    this->gohome = false;
+    this->id = id;
+    this->shop = shop;
+    this->myCustomer = nullptr;
+    this->awakened_at = 0;
+    this->seated_at = 0;
+    this->state.store(hs_asleep, memory_order_relaxed);
+    this->cond_barber = reinterpret_cast<pthread_cond_t*> (malloc(sizeof (pthread_cond_t))); // allocting mem for cond var
+    pthread_cond_init(this->cond_barber, NULL); // initializing the cond variable
+    this->barber_mutex = reinterpret_cast<pthread_mutex_t*> (malloc(sizeof (pthread_mutex_t))); // allocating mem for mutex
+    pthread_mutex_init(barber_mutex, NULL); // intializing the mutex
+}
+
+// Barber thread.  Must be joined by Shop thread to allow shop to
+// determine when barbers have left.
+
+void* run_barber(void* arg) {
+    Barber* barber = reinterpret_cast<Barber*> (arg);
+    barber->run();
+    return nullptr;
+}
+
+void Barber::closing_time() { // function to turn the boolean of go home to true so that the barber knows the shop has closed
+    if (this->shop->settings().futex_handshake) {
+        int asleep = hs_asleep;
+        this->gohome = true;
+        if (this->state.compare_exchange_strong(asleep, hs_gohome)) { // only a sleeping barber is sent home
+            if (this->shop->coroutine_scheduler() != nullptr) {
+                this->wake_event.set(this->shop->coroutine_scheduler());
+            } else {
+                futex_wake(this->state);
+            }
+        }
+        return;
+    }
+    Lock lock(this->barber_mutex, this->shop->lock_stats(barber_lock));
+    this->gohome = true;
+    pthread_cond_signal(this->cond_barber);
+}
+
+void Barber::awaken(Customer* customer) { // function to assign a customer to the barber
+    if (this->shop->settings().futex_handshake) {
+        if (this->myCustomer == nullptr) {
+            this->awakened_at = this->shop->now();
+            this->myCustomer = customer;
+            this->post(hs_awakened);
+        }
+        return;
+    }
+    Lock lock(this->barber_mutex, this->shop->lock_stats(barber_lock));
+    if (this->myCustomer == nullptr) { // awaken is repeated during the handshake; time the first one
+        this->awakened_at = this->shop->now();
+    }
+    this->myCustomer = customer;
+    pthread_cond_signal(this->cond_barber);
+}
+
+void Barber::customer_sits() { // function to let the barber know it has a customer sitting 
+    if (this->shop->settings().futex_handshake) {
+        this->seated_at = this->shop->now();
+        this->post(hs_seated);
+        return;
+    }
+    Lock lock(this->barber_mutex, this->shop->lock_stats(barber_lock));
+    this->seated_at = this->shop->now();
+    this->hassitting = true;
+    pthread_cond_signal(cond_barber);
+}
+
+void Barber::payment() { // function to let the barber know if the customer has paid him or not
+    if (this->shop->settings().futex_handshake) {
+        this->post(hs_paid);
+        return;
+    }
+    Lock lock(this->barber_mutex, this->shop->lock_stats(barber_lock));
+    this->gotpaid = true;
+    pthread_cond_signal(cond_barber);
+}
+
+void Barber::post(int state) {
+    this->state.store(state, memory_order_release);
+    if (this->shop->coroutine_scheduler() != nullptr) {
+        this->wake_event.set(this->shop->coroutine_scheduler());
+    } else {
+        futex_wake(this->state);
+    }
+}
+
+Customer* Barber::customer() const {
+    return this->myCustomer;
+}
+
+void Barber::reset() {
+    if (this->shop->settings().futex_handshake) {
+        this->myCustomer = nullptr;
+        this->awakened_at = 0;
+        this->seated_at = 0;
+        this->state.store(hs_asleep, memory_order_release); // nobody waits for this transition
+        return;
+    }
+    Lock lock(this->barber_mutex, this->shop->lock_stats(barber_lock));
+    this->hassitting = false; // reseting barber states
+    this->gotpaid = false; //resetting states
+    this->myCustomer = nullptr; // unassigning the current customer as he is done with his haircut
+    this->awakened_at = 0;
+    this->seated_at = 0;
 }
 
 Customer::Customer(Shop* shop, int id) {
+    this->reuse(shop, id);
+    this->cond_customer = reinterpret_cast<pthread_cond_t*> (malloc(sizeof (pthread_cond_t))); //allocating mem to cond var
+    pthread_cond_init(this->cond_customer, NULL); // initializing it
+    this->customer_mutex = reinterpret_cast<pthread_mutex_t*> (malloc(sizeof (pthread_mutex_t)));// allocating mem to mutex
+    pthread_mutex_init(customer_mutex, NULL); // initalizing mutex
+}
+
+void Customer::post(int state) {
+    CoScheduler* scheduler = this->shop->coroutine_scheduler(); // read before the customer can move on
+    this->state.store(state, memory_order_release);
+    if (scheduler != nullptr) {
+        this->wake_event.set(scheduler);
+    } else {
+        futex_wake(this->state);
+    }
+}
+
+// --coroutines: co_run may see hs_paid before payment_accepted has
+// finished setting wake_event, so the Customer goes back to the pool
+// only once both have let go of it.
+
+void Customer::leave() {
+    if (this->holds.fetch_sub(1, memory_order_acq_rel) == 1) {
+        this->shop->release_customer(this);
+    }
+}
+
+void Customer::reuse(Shop* shop, int id) {
+    this->wake_event.reset();
+    this->holds.store(2, memory_order_relaxed);
     this->paid=false;    // setting all flags to false
+    this->evicted=false;
     this->awakenedbarber=false;
     this->hadhaircut=false;
     this->shop = shop;
     this->id = id;
     this->myBarber = nullptr; // initializing the barber to be nullptr
-    this->cond_customer = reinterpret_cast<pthread_cond_t*> (malloc(sizeof (pthread_cond_t))); //allocating mem to cond var
-    pthread_cond_init(this->cond_customer, NULL); // initializing it
-    this->customer_mutex = reinterpret_cast<pthread_mutex_t*> (malloc(sizeof (pthread_mutex_t)));// allocating mem to mutex
-    pthread_mutex_init(customer_mutex, NULL); // initalizing mutex
+    this->arrived_at = 0;
+    this->called_at = 0;
+    this->service_ms = -1;
+    this->priority = 0;
+    this->preadmitted = false;
+    this->state.store(hs_asleep, memory_order_relaxed);
+}
+
+void Customer::admitted(Shop::BarberOrWait outcome) {
+    this->admission = outcome;
+    this->preadmitted = true;
+}
+
+Shop::BarberOrWait Customer::enter() {
+    if (this->preadmitted) {
+        return this->admission;
+    }
+    return this->shop->arrives(this);
+}
+
+// Customer thread.  Runs in detatched mode so resources are
+// automagically cleaned up when customer leaves shop.
+
+void* run_customer(void* arg) {
+    Customer* customer = reinterpret_cast<Customer*> (arg);
+    customer->run();
+    customer->shop_of()->release_customer(customer);
+    return nullptr;
+}
+
+CustomerPool::~CustomerPool() {
+    for (auto customer : this->free_customers) {
+        delete customer;
+    }
+}
+
+Customer* CustomerPool::acquire(Shop* shop, int id) {
+    int now_live = ++this->live;
+    int seen = this->peak.load();
+    while (now_live > seen && !this->peak.compare_exchange_weak(seen, now_live)) {
+    }
+    pthread_mutex_lock(&this->free_mutex);
+    if (this->free_customers.empty()) { // pool grows only while the shop gets busier than ever before
+        this->created++;
+        pthread_mutex_unlock(&this->free_mutex);
+        return new Customer(shop, id);
+    }
+    Customer* customer = this->free_customers.back();
+    this->free_customers.pop_back();
+    pthread_mutex_unlock(&this->free_mutex);
+    customer->reuse(shop, id);
+    return customer;
+}
+
+void CustomerPool::release(Customer* customer) {
+    pthread_mutex_lock(&this->free_mutex);
+    this->free_customers.push_back(customer); // capacity never exceeds created, so no reallocation at steady state
+    if (--this->live == 0) {
+        pthread_cond_broadcast(&this->empty_cond);
+    }
+    pthread_mutex_unlock(&this->free_mutex);
+}
+
+bool CustomerPool::wait_empty(const struct timespec* deadline) {
+    pthread_mutex_lock(&this->free_mutex);
+    while (this->live > 0) {
+        if (deadline == nullptr) {
+            pthread_cond_wait(&this->empty_cond, &this->free_mutex);
+        } else if (pthread_cond_timedwait(&this->empty_cond, &this->free_mutex, deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    bool empty = this->live == 0;
+    pthread_mutex_unlock(&this->free_mutex);
+    return empty;
+}
+
+CustomerWorkers::CustomerWorkers(int n_workers, const pthread_attr_t* attr) {
+    this->stopping = false;
+    pthread_mutex_init(&this->tasks_mutex, NULL);
+    pthread_cond_init(&this->tasks_cond, NULL);
+    this->workers.resize(n_workers);
+    for (int i = 0; i < n_workers; i++) {
+        int rc = pthread_create(&this->workers[i], attr, run_worker, reinterpret_cast<void*> (this));
+        if (rc != 0) {
+            errno = rc;
+            perror("creating pthread");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void* CustomerWorkers::run_worker(void* arg) {
+    reinterpret_cast<CustomerWorkers*> (arg)->work();
+    return nullptr;
+}
+
+void CustomerWorkers::submit(Customer* customer) {
+    pthread_mutex_lock(&this->tasks_mutex);
+    this->tasks.push(customer);
+    pthread_cond_signal(&this->tasks_cond);
+    pthread_mutex_unlock(&this->tasks_mutex);
+}
+
+void CustomerWorkers::work() { // worker thread: run queued customers until shutdown
+    while (true) {
+        pthread_mutex_lock(&this->tasks_mutex);
+        while (this->tasks.empty() && !this->stopping) {
+            pthread_cond_wait(&this->tasks_cond, &this->tasks_mutex);
+        }
+        if (this->tasks.empty()) { // stopping and nothing left to run
+            pthread_mutex_unlock(&this->tasks_mutex);
+            return;
+        }
+        Customer* customer = this->tasks.front();
+        this->tasks.pop();
+        pthread_mutex_unlock(&this->tasks_mutex);
+        run_customer(customer);
+    }
+}
+
+void CustomerWorkers::shutdown() {
+    pthread_mutex_lock(&this->tasks_mutex);
+    this->stopping = true;
+    pthread_cond_broadcast(&this->tasks_cond);
+    pthread_mutex_unlock(&this->tasks_mutex);
+    for (auto thread : this->workers) {
+        pthread_join(thread, nullptr);
+    }
+    this->workers.clear();
+}
+
+Customer::~Customer() {
+    event_log.log(customer_deleted);
+    pthread_cond_destroy(this->cond_customer); // destroying yhe cond variable so no mem leaks
+    pthread_mutex_destroy(this->customer_mutex); // destroying the mutex to free mem
+    free(this->cond_customer);
+    free(this->customer_mutex);
+}
+
+void Customer::run() { // customer thread
+    if (this->shop->settings().futex_handshake) {
+        this->run_futex();
+        return;
+    }
+    if (!this->preadmitted) { // a --burst group is logged by the shop as it arrives
+        event_log.log(customer_arrived, this->id);
+    }
+    bool chair;
+    Barber* wakedup;
+    Shop::BarberOrWait b = this->enter();
+    wakedup = b.barber;
+    chair = b.chair_available;
+
+    if (wakedup == nullptr) { // check if there is no barber available
+        if (chair == true) { // if there is a chair then the customer will wait in the waiting room (seat logged by the shop)
+            Lock lock(this->customer_mutex, this->shop->lock_stats(customer_lock));
+            while (this->myBarber == nullptr && !this->evicted) { // customer will wait for a barber to call him
+                lock.wait(this->cond_customer);
+            }
+            if (this->evicted) { // the shop closed with him still in the waiting room
+                lock.unlock();
+                event_log.log(customer_leaves_unserved, this->id);
+                return;
+            }
+            this->customer_state = standup;
+            lock.unlock();
+        } else {
+            event_log.log(customer_leaves_unserved, this->id);
+	   return; // if the customer has no chairs in the waiting room then it will just leave 
+        }
+    } else {
+        Lock lock(this->customer_mutex, this->shop->lock_stats(customer_lock));
+        this->myBarber = wakedup; // if the customer has a barber then assign its barber to the waked up barber
+        this->customer_state = standup;
+        lock.unlock();
+    }
+
+    Lock lock(this->customer_mutex, this->shop->lock_stats(customer_lock));
+    event_log.log(customer_wakes_barber, this->id, this->myBarber->id); // waking up barber
+    this->myBarber->awaken(this); // calling awaken for the customer to awaken the barber assigned to him
+    while (this->awakenedbarber == false) {
+        lock.wait(this->cond_customer); // after awaking the barber, customer will wait then sit
+    }
+    event_log.log(customer_sits_down, this->id, this->myBarber->id);
+    lock.unlock();
+
+    this->myBarber->customer_sits();
+
+    lock.lock();
+    while (this->hadhaircut == false) { // wait until barber finishes the hair cut
+        lock.wait(this->cond_customer);
+    }
+    event_log.log(customer_pays, this->id, this->myBarber->id); //cutomer gets up and offer to pay
+    lock.unlock();
+
+    this->myBarber->payment(); // call the payment method to signal
+
+    lock.lock();
+    while (this->paid == false) {
+        lock.wait(this->cond_customer); // wait until the barber accepts the payment
+    }
+    this->myBarber=nullptr;
+    event_log.log(customer_leaves, this->id); // customer leaves
+}
+
+// Customer thread with the --futex handshake: the same protocol, but
+// each wait is on the customer's own state word.
+
+void Customer::run_futex() {
+    if (!this->preadmitted) {
+        event_log.log(customer_arrived, this->id);
+    }
+    Shop::BarberOrWait b = this->enter();
+    if (b.barber == nullptr) {
+        if (!b.chair_available) {
+            event_log.log(customer_leaves_unserved, this->id);
+            return;
+        }
+        futex_wait_while(this->state, hs_asleep); // until a barber calls
+        if (this->state.load(memory_order_acquire) == hs_gohome) { // evicted at closing
+            event_log.log(customer_leaves_unserved, this->id);
+            return;
+        }
+    } else {
+        this->myBarber = b.barber;
+    }
+
+    event_log.log(customer_wakes_barber, this->id, this->myBarber->id);
+    this->myBarber->awaken(this);
+    futex_wait_for(this->state, hs_called);
+    event_log.log(customer_sits_down, this->id, this->myBarber->id);
+    this->myBarber->customer_sits();
+
+    futex_wait_for(this->state, hs_done);
+    event_log.log(customer_pays, this->id, this->myBarber->id);
+    this->myBarber->payment();
+
+    futex_wait_for(this->state, hs_paid);
+    this->myBarber = nullptr;
+    event_log.log(customer_leaves, this->id);
+}
+
+// Barber calls this customer after checking the waiting-room
+// queue (customer should be waitint).
+
+void Customer::next_customer(Barber* barber) {
+    if (this->shop->settings().futex_handshake) {
+        if (this->called_at == 0) { // only the barber calls, so no race on called_at
+            this->called_at = this->shop->now();
+            this->shop->record(waiting_room_latency, this->called_at - this->arrived_at);
+            this->myBarber = barber;
+            this->post(hs_called);
+        }
+        return;
+    }
+    Lock lock(this->customer_mutex, this->shop->lock_stats(customer_lock));
+    if (this->called_at == 0) { // the barber calls twice during the handshake; time the first call
+        this->called_at = this->shop->now();
+        this->shop->record(waiting_room_latency, this->called_at - this->arrived_at);
+    }
+    if (this->myBarber != barber) { // the second call must not write: the customer reads myBarber unlocked
+        this->myBarber = barber; // assign the barber to the customer
+    }
+    this->awakenedbarber=true;
+    pthread_cond_signal(this->cond_customer);
+}
+
+void Customer::finished() { // function to set that the customer finished his hair cut and signal
+    if (this->shop->settings().futex_handshake) {
+        this->post(hs_done);
+        return;
+    }
+    Lock lock(this->customer_mutex, this->shop->lock_stats(customer_lock));
+    this->hadhaircut = true;
+    pthread_cond_signal(this->cond_customer);
+}
+
+void Customer::payment_accepted() { // function to set customer to paid
+    this->shop->record(total_latency, this->shop->now() - this->arrived_at);
+    if (this->shop->settings().futex_handshake) {
+        bool coroutine = this->shop->coroutine_scheduler() != nullptr; // the customer may be gone after post
+        this->post(hs_paid);
+        if (coroutine) {
+            this->leave();
+        }
+        return;
+    }
+    Lock lock(this->customer_mutex, this->shop->lock_stats(customer_lock));
+    this->paid=true;
+    pthread_cond_signal(this->cond_customer);
+}
+
+void Customer::evict() {
+    if (this->shop->settings().futex_handshake) {
+        bool coroutine = this->shop->coroutine_scheduler() != nullptr; // the customer may be gone after post
+        this->post(hs_gohome);
+        if (coroutine) {
+            this->leave();
+        }
+        return;
+    }
+    Lock lock(this->customer_mutex, this->shop->lock_stats(customer_lock));
+    this->evicted = true;
+    pthread_cond_signal(this->cond_customer);
+}
+
+void Barber::run() {
+    if (this->shop->settings().futex_handshake) {
+        this->run_futex();
+        return;
+    }
+    event_log.log(barber_arrives, this->id);
+    Customer * nextcustomer;
+    while (true) { // barber thread goes into an infinite while loop until it gets broken by shop closing
+        nextcustomer = this->shop->next_customer(this); // calls next customer to check the waiting room
+        if (nextcustomer != nullptr) { // if there is a customer waiting then call him
+            event_log.log(barber_calls, this->id, this->myCustomer->id);
+            nextcustomer->next_customer(this);
+        }
+        else if (nextcustomer == nullptr && !this->shop->shop_open) { // if there are no customers and the shop is closed then b          //arber leaves for home
+            event_log.log(barber_leaves, this->id);
+            break;
+        }
+        else { // if there is no csutmers waiting but shop is still open then go for a nap
+            Lock lock(this->barber_mutex, this->shop->lock_stats(barber_lock));
+            event_log.log(barber_naps, this->id);
+            // did the shop close?
+            while (this->myCustomer == nullptr && !this->gohome) {
+                lock.wait(this->cond_barber); //wait until a customer arrives to wake the barber up
+            }
+
+            if (this->gohome) {
+                lock.unlock();
+                event_log.log(barber_sent_home, this->id); // if while sleeping the shop has closed //then break the loop and go home
+                break;
+            }
+            // if no customer, shop must be closed...
+            this->barber_state = awake; 
+            nextcustomer = this->myCustomer; // set the next customer to myCustomer
+            lock.unlock();
+        }
+
+        // barber services customer
+        // usleep...
+        // customer->finished()
+        // wait_for_payment()
+        //      check (mutex & condition_wait (if necessary)) 
+        //           this->paid or this->state == paid
+        // customer->accepted_payement()
+        //
+        // reset state variables 
+
+        event_log.log(barber_wakes, this->id);
+        nextcustomer->next_customer(this); // barber wakes up and sets the next customer to his customer
+
+        Lock lock(this->barber_mutex, this->shop->lock_stats(barber_lock));
+        while (this->hassitting == false) { // wait until the customer sits down
+            lock.wait(this->cond_barber);
+        }
+        this->shop->record(handoff_latency, this->seated_at - this->awakened_at);
+        lock.unlock();
+
+        this->cut_hair(); // without holding barber_mutex, which the customer needs to pay
+
+        nextcustomer->finished(); // call finished to signal to customer
+
+        lock.lock();
+        while (this->gotpaid == false) { // wait until the customer pays
+            lock.wait(this->cond_barber);
+        }
+        event_log.log(barber_paid, this->id, this->myCustomer->id);
+        lock.unlock();
+
+        nextcustomer->payment_accepted(); // call payment accepted to signal to customer
+
+        this->reset();
+    }
+}
+
+void Barber::cut_hair() {
+    event_log.log(barber_cuts, this->id, this->myCustomer->id);
+    long long started = this->shop->now();
+    this->shop->service_started();
+    usleep(this->shop->service_time(this->myCustomer)*1000); // service time
+    this->shop->service_finished();
+    this->shop->record(service_latency, this->shop->now() - started);
+    event_log.log(barber_finishes, this->id, this->myCustomer->id); // finish the hair cut
+}
+
+// Barber thread with the --futex handshake: the same protocol, but
+// each wait is on the barber's own state word.
+
+void Barber::run_futex() {
+    event_log.log(barber_arrives, this->id);
+    while (true) {
+        Customer * nextcustomer = this->shop->next_customer(this); // shop awakens us if someone is waiting
+        if (nextcustomer != nullptr) {
+            event_log.log(barber_calls, this->id, nextcustomer->id);
+        } else if (!this->shop->shop_open) {
+            event_log.log(barber_leaves, this->id);
+            break;
+        } else {
+            event_log.log(barber_naps, this->id);
+            if (futex_wait_while(this->state, hs_asleep) == hs_gohome) {
+                event_log.log(barber_sent_home, this->id);
+                break;
+            }
+            nextcustomer = this->myCustomer;
+        }
+
+        event_log.log(barber_wakes, this->id);
+        nextcustomer->next_customer(this);
+        futex_wait_for(this->state, hs_seated);
+        this->shop->record(handoff_latency, this->seated_at - this->awakened_at);
+
+        this->cut_hair();
+        nextcustomer->finished();
+
+        futex_wait_for(this->state, hs_paid);
+        event_log.log(barber_paid, this->id, nextcustomer->id);
+        nextcustomer->payment_accepted();
+        this->reset();
+    }
+}
+
+// --coroutines: Barber::run_futex with co_await in place of each
+// futex wait and a scheduler timer in place of usleep.
+
+CoTask Barber::co_run() {
+    event_log.log(barber_arrives, this->id);
+    while (true) {
+        Customer * nextcustomer = this->shop->next_customer(this);
+        if (nextcustomer != nullptr) {
+            event_log.log(barber_calls, this->id, nextcustomer->id);
+        } else if (!this->shop->shop_open) {
+            event_log.log(barber_leaves, this->id);
+            break;
+        } else {
+            event_log.log(barber_naps, this->id);
+            while (this->state.load(memory_order_acquire) == hs_asleep) {
+                co_await this->wake_event;
+            }
+            if (this->state.load(memory_order_acquire) == hs_gohome) {
+                event_log.log(barber_sent_home, this->id);
+                break;
+            }
+            nextcustomer = this->myCustomer;
+        }
+
+        event_log.log(barber_wakes, this->id);
+        nextcustomer->next_customer(this);
+        while (this->state.load(memory_order_acquire) != hs_seated) {
+            co_await this->wake_event;
+        }
+        this->shop->record(handoff_latency, this->seated_at - this->awakened_at);
+
+        event_log.log(barber_cuts, this->id, nextcustomer->id);
+        long long started = this->shop->now();
+        this->shop->service_started();
+        co_await this->shop->coroutine_scheduler()->sleep_for(this->shop->service_time(nextcustomer));
+        this->shop->service_finished();
+        this->shop->record(service_latency, this->shop->now() - started);
+        event_log.log(barber_finishes, this->id, nextcustomer->id);
+        nextcustomer->finished();
+
+        while (this->state.load(memory_order_acquire) != hs_paid) {
+            co_await this->wake_event;
+        }
+        event_log.log(barber_paid, this->id, nextcustomer->id);
+        nextcustomer->payment_accepted();
+        this->reset();
+    }
+}
+
+// --coroutines: Customer::run_futex with co_await in place of each
+// futex wait.
+
+CoTask Customer::co_run() {
+    if (!this->preadmitted) {
+        event_log.log(customer_arrived, this->id);
+    }
+    Shop::BarberOrWait b = this->enter();
+    if (b.barber == nullptr && !b.chair_available) {
+        event_log.log(customer_leaves_unserved, this->id);
+        this->shop->release_customer(this);
+        co_return;
+    }
+    if (b.barber == nullptr) {
+        while (this->state.load(memory_order_acquire) == hs_asleep) { // until a barber calls
+            co_await this->wake_event;
+        }
+        if (this->state.load(memory_order_acquire) == hs_gohome) { // evicted at closing
+            event_log.log(customer_leaves_unserved, this->id);
+            this->leave();
+            co_return;
+        }
+    } else {
+        this->myBarber = b.barber;
+    }
+
+    event_log.log(customer_wakes_barber, this->id, this->myBarber->id);
+    this->myBarber->awaken(this);
+    while (this->state.load(memory_order_acquire) != hs_called) {
+        co_await this->wake_event;
+    }
+    event_log.log(customer_sits_down, this->id, this->myBarber->id);
+    this->myBarber->customer_sits();
+
+    while (this->state.load(memory_order_acquire) != hs_done) {
+        co_await this->wake_event;
+    }
+    event_log.log(customer_pays, this->id, this->myBarber->id);
+    this->myBarber->payment();
+
+    while (this->state.load(memory_order_acquire) != hs_paid) {
+        co_await this->wake_event;
+    }
+    this->myBarber = nullptr;
+    event_log.log(customer_leaves, this->id);
+    this->leave();
+}
+
+// Constructor initializes shop and creates Barber threads (which
+// will immediately start calling next_customer to fill the
+// collection of sleeping barbers).
+
+Shop::Shop(int n_barbers,
+        unsigned int waiting_chairs,
+        int average_service_time,
+        int service_time_deviation,
+        int average_customer_arrival,
+        int duration,
+        ShopOptions options) : generation(++generations) {
+
+    // Initializing mutex
+
+    this->shop_mutex = reinterpret_cast<pthread_mutex_t*> (malloc(sizeof (pthread_mutex_t))); // memory allocation for shp mutex
+    pthread_mutex_init(this->shop_mutex, NULL); // initializing shop mutex
+    this->n_barbers = n_barbers; // setting number of barbers
+    this->duration = duration;
+    this->options = options;
+    this->waiting_chairs = waiting_chairs; //setting shop variables
+    this->average_customer_arrival = average_customer_arrival;
+    this->service_time_deviation = service_time_deviation;
+    this->average_service_time = average_service_time;
+
+    if (!this->options.fixed_seed) {
+        random_device entropy;
+        this->options.seed = ((unsigned long) entropy() << 32) ^ entropy();
+    }
+    seed_seq arrival_seed{this->options.seed, 1UL};
+    seed_seq service_seed{this->options.seed, 2UL};
+    seed_seq class_seed{this->options.seed, 3UL};
+    this->arrival_generator.seed(arrival_seed);
+    this->service_generator.seed(service_seed);
+    this->class_generator.seed(class_seed);
+    this->service_variates.reset(average_service_time, service_time_deviation);
+    pthread_mutex_init(&this->rng_mutex, NULL);
+    pthread_mutex_init(&this->recorders_mutex, NULL);
+    pthread_mutex_init(&this->staffing_mutex, NULL);
+    if (!this->options.replay_path.empty()) {
+        this->replay.map(this->options.replay_path);
+    }
+
+    this->chairs = WaitingRoom::create(this->options);
+    this->sleeping_barbers = IdleBarbers::create(this->options);
+    this->placement = ThreadPlacement(this->options);
+    if (this->options.autoscale_max > 0) { // the day starts with nbarbers, within the autoscaling range
+        this->n_barbers = min(max(this->n_barbers, this->options.autoscale_min), this->options.autoscale_max);
+    }
+    if (this->options.scale_up_queue <= 0) {
+        this->options.scale_up_queue = max(this->waiting_chairs / 2, 1u);
+    }
+    for (int i = 0; i < max(this->n_barbers, this->options.autoscale_max); i++) {
+        this->barbers.push_back(new Barber(this, i)); //id = n_barbers and keeps incrementing 0 -> n_barbers
+    }
+}
+
+void Shop::open() {
+    int rc = clock_gettime(CLOCK_REALTIME, &time_limit);
+    if (rc < 0) {
+        perror("reading realtime clock");
+        exit(EXIT_FAILURE);
+    }
+    // Round to nearest second
+    time_limit.tv_sec += duration + (time_limit.tv_nsec >= 500000000);
+    time_limit.tv_nsec = 0;
+
+    // A fresh day: nothing carries over from a previous run().
+    this->customers_served_immediately.reset();
+    this->customers_waited.reset();
+    this->customers_turned_away.reset();
+    this->customers_total.reset();
+    this->customers_redirected_out.reset();
+    this->customers_redirected_in.reset();
+    this->customers_stolen.reset();
+    this->customers_evicted.reset();
+    this->admission_locks.reset();
+    for (auto& profile : this->lock_profiles) {
+        profile.reset();
+    }
+    this->services_started.reset();
+    this->services_finished.reset();
+    pthread_mutex_lock(&this->recorders_mutex);
+    for (auto recorder : this->recorders) {
+        delete recorder;
+    }
+    for (auto recorder : this->warmup_recorders) {
+        delete recorder;
+    }
+    this->recorders.clear();
+    this->warmup_recorders.clear();
+    this->generation = ++generations; // threads start new histograms
+    pthread_mutex_unlock(&this->recorders_mutex);
+
+    Lock lock(this->shop_mutex, this->lock_stats(shop_lock));
+    this->reset_rooms(); // stale entries from barbers who left after closing
+    this->queue_depth = 0;
+    this->sleeping_count = 0;
+    lock.unlock();
+    if (this->options.lock_free) {
+        delete this->waiting_ring;
+        delete this->idle_barbers;
+        this->waiting_ring = new WaitingRoomRing(max(this->waiting_chairs, 1u));
+        this->idle_barbers = new IdleBarberStack(this->barbers.size());
+        this->admission = 0;
+    }
+    for (auto barber : this->barbers) {
+        barber->gohome = false;
+        barber->reset();
+    }
+    if (this->options.virtual_time) { // the day starts at 0 on a fresh scheduler
+        this->scheduler = EventScheduler();
+        event_log.set_clock(virtual_clock, this);
+    }
+    if (this->options.reactor) {
+        delete this->reactor; // a fresh lag histogram for the day
+        this->reactor = new Reactor();
+    }
+    this->shop_open = true;
+    this->opened_at = this->measured_from = this->now();
+    this->warming_up = this->options.warmup_seconds > 0;
+    this->warmup_arrivals = 0;
+    event_log.log(shop_opens);
+
+    this->on_duty.assign(this->barbers.size(), false);
+    this->barber_threads.assign(this->barbers.size(), nullptr);
+    this->staffed = this->peak_staffed = this->n_barbers;
+    this->hires = this->retirements = this->quiet_windows = 0;
+    this->barber_ns = 0;
+    this->day_barber_seconds = 0;
+    this->staffing_changed_at = this->opened_at;
+    this->window_total = this->window_turned_away = 0;
+
+    if (this->options.coroutine_workers > 0) { // barbers are coroutines on a few worker threads
+        delete this->coroutines; // drained at the end of the previous day
+        this->coroutines = new CoScheduler(this->options.coroutine_workers);
+        for (auto barber : this->barbers) {
+            this->on_duty[barber->id] = true;
+            this->coroutines->spawn(barber->co_run());
+        }
+        return;
+    }
+
+    // Creating Barber Threads (or, in virtual time, barbers driven by
+    // the event scheduler)
+
+    event_log.log(this->options.virtual_time ? shop_creates_virtual_barbers : shop_creates_barbers, n_barbers);
+    for (int i = 0; i < this->n_barbers; i++) {
+        this->start_barber(this->barbers[i]);
+    }
+}
+
+void Shop::start_barber(Barber* barber) {
+    this->on_duty[barber->id] = true;
+    if (this->options.virtual_time) { // no thread: the barber calls next_customer right away
+        event_log.log(barber_arrives, barber->id);
+        Customer * nextcustomer = this->next_customer(barber);
+        if (nextcustomer != nullptr) { // hired while customers were waiting
+            event_log.log(barber_calls, barber->id, nextcustomer->id);
+            this->virtual_haircut(barber, nextcustomer);
+        } else {
+            event_log.log(barber_naps, barber->id);
+        }
+        return;
+    }
+    pthread_t* thread = reinterpret_cast<pthread_t*> (calloc(1, sizeof (pthread_t))); // mem allocation for thread
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    this->placement.barber_attr(&attr, barber->id);
+    int rc = pthread_create(thread, &attr, run_barber, (void*) barber); // thread creation using the created barber
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        errno = rc;
+        perror("creating pthread");
+        exit(EXIT_FAILURE);
+    }
+    this->barber_threads[barber->id] = thread;
+}
+
+void Shop::staffing_changed(int delta) {
+    long long now = this->now();
+    pthread_mutex_lock(&this->staffing_mutex);
+    this->barber_ns += this->staffed * (now - this->staffing_changed_at);
+    this->staffing_changed_at = now;
+    this->staffed += delta;
+    pthread_mutex_unlock(&this->staffing_mutex);
+    this->peak_staffed = max(this->peak_staffed, this->staffed.load());
+}
+
+double Shop::barber_seconds() const {
+    long long until = this->shop_open ? this->now() : this->drained_at;
+    pthread_mutex_lock(&this->staffing_mutex);
+    double seconds = (this->barber_ns + this->staffed * (until - this->staffing_changed_at)) / 1e9;
+    pthread_mutex_unlock(&this->staffing_mutex);
+    return seconds;
+}
+
+// End of the warm-up: from here on the counters, the latency
+// histograms and the barber-seconds describe the steady state.
+// Customers still in the shop finish normally; their haircuts and
+// latencies from now on are counted, their arrivals are not.
+
+void Shop::end_warmup() {
+    this->warming_up = false;
+    this->warmup_arrivals = this->customers_total;
+    this->customers_served_immediately.reset();
+    this->customers_waited.reset();
+    this->customers_turned_away.reset();
+    this->customers_total.reset();
+    this->customers_redirected_out.reset();
+    this->customers_redirected_in.reset();
+    this->customers_stolen.reset();
+    this->customers_evicted.reset();
+    this->admission_locks.reset();
+    for (auto& profile : this->lock_profiles) {
+        profile.reset();
+    }
+    pthread_mutex_lock(&this->recorders_mutex);
+    this->warmup_recorders.insert(this->warmup_recorders.end(), this->recorders.begin(), this->recorders.end());
+    this->recorders.clear();
+    this->generation = ++generations; // threads start new histograms
+    pthread_mutex_unlock(&this->recorders_mutex);
+    this->measured_from = this->now();
+    pthread_mutex_lock(&this->staffing_mutex);
+    this->barber_ns = 0;
+    this->staffing_changed_at = this->measured_from;
+    pthread_mutex_unlock(&this->staffing_mutex);
+    event_log.log(shop_warmed_up);
+}
+
+// Autoscaler, once per --scale-interval while the shop is open: hire
+// as soon as the queue or the window's turn-away rate crosses its
+// threshold, but retire only after scale_down_windows quiet windows
+// in a row (nobody waiting or turned away, a barber asleep), so a
+// brief lull does not send a barber home just before he is needed.
+
+void Shop::autoscale() {
+    unsigned long total = this->customers_total;
+    unsigned long turned_away = this->customers_turned_away;
+    double turnaway_rate = total > this->window_total
+            ? (double) (turned_away - this->window_turned_away) / (total - this->window_total) : 0.0;
+    this->window_total = total;
+    this->window_turned_away = turned_away;
+
+    int waiting = this->waiting_customers();
+    if (waiting >= this->options.scale_up_queue || turnaway_rate > this->options.scale_up_turnaway) {
+        this->quiet_windows = 0;
+        if (this->staffed < this->options.autoscale_max && this->sleeping_barber_count() == 0) {
+            this->hire();
+        }
+    } else if (waiting == 0 && turnaway_rate == 0 && this->sleeping_barber_count() > 0) {
+        if (++this->quiet_windows >= this->options.scale_down_windows && this->staffed > this->options.autoscale_min) {
+            this->quiet_windows = 0;
+            this->retire();
+        }
+    } else {
+        this->quiet_windows = 0;
+    }
+}
+
+void Shop::hire() {
+    for (auto barber : this->barbers) {
+        if (!this->on_duty[barber->id]) {
+            barber->gohome = false;
+            barber->reset();
+            this->staffing_changed(+1);
+            this->hires++;
+            this->start_barber(barber);
+            return;
+        }
+    }
+}
+
+// Send one sleeping barber home.  Taking him out of sleeping_barbers
+// first means no arrival can wake him in the meantime.
+
+void Shop::retire() {
+    Lock lock(this->shop_mutex, this->lock_stats(shop_lock));
+    if (this->sleeping_barbers->empty()) { // someone arrived since autoscale() looked
+        lock.unlock();
+        return;
+    }
+    Barber* barber = this->sleeping_barbers->pop();
+    this->sleeping_count--;
+    lock.unlock();
+
+    barber->closing_time();
+    if (this->options.virtual_time) {
+        event_log.log(barber_sent_home, barber->id);
+    } else {
+        pthread_join(*this->barber_threads[barber->id], nullptr); // he leaves as soon as he wakes up
+        free(this->barber_threads[barber->id]);
+        this->barber_threads[barber->id] = nullptr;
+    }
+    this->on_duty[barber->id] = false;
+    this->staffing_changed(-1);
+    this->retirements++;
+}
+
+void* Shop::run_scaler(void* arg) {
+    Shop* shop = reinterpret_cast<Shop*> (arg);
+    struct pollfd wakeup = {shop->scaler_wakeup, POLLIN, 0};
+    while (true) {
+        if (poll(&wakeup, 1, shop->options.scale_interval_ms) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (wakeup.revents & POLLIN) { // closing time
+            break;
+        }
+        shop->autoscale();
+    }
+    return nullptr;
+}
+
+void Shop::run() {
+    //cout << "the Barber shop opens" << endl;
+    if (!shop_open) { // initilizing barber shop (a ShopCluster opens its shards itself)
+        this->open();
+    }
+
+    MetricsExporter metrics; // a cluster runs one exporter for all its shards
+    if (!this->options.metrics_path.empty() && this->options.cluster == nullptr) {
+        metrics.start(this->options.metrics_path, this->options.metrics_interval_ms, {this});
+    }
+
+    if (this->options.virtual_time) {
+        this->run_virtual();
+        return;
+    }
+
+    if (this->options.autoscale_max > 0) {
+        this->scaler_wakeup = eventfd(0, EFD_CLOEXEC);
+        if (this->scaler_wakeup < 0) {
+            perror("eventfd");
+            exit(EXIT_FAILURE);
+        }
+        int rc = pthread_create(&this->scaler, nullptr, run_scaler, reinterpret_cast<void*> (this));
+        if (rc != 0) {
+            errno = rc;
+            perror("creating pthread");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_attr_t customer_attr; // placement and stack size of customer threads
+    pthread_attr_init(&customer_attr);
+    this->placement.customer_attr(&customer_attr);
+    if (this->options.customer_workers > 0) {
+        this->customer_workers = new CustomerWorkers(this->options.customer_workers, &customer_attr);
+    }
+
+    vector<Customer*>& group = this->arrival_group; // --burst: customers arriving together
+    for (int next_customer_id = 0;; next_customer_id += this->options.burst) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec >= time_limit.tv_sec) {
+            // Shop closes.
+            break;
+        }// Wait for random delay, then create new Customer thread.
+        if (this->warming_up && this->now() - this->opened_at >= this->options.warmup_seconds * 1000000000LL) {
+            this->end_warmup(); // customers from here on are measured
+        }
+        if (this->options.burst == 1) {
+            Customer * customer = this->customer_pool.acquire(this, next_customer_id); // recycled customer
+            this->customers_total++; // incrementing number of customers
+            this->dispatch(customer, &customer_attr); // the customer calls arrives() himself
+        } else {
+            group.clear();
+            for (int i = 0; i < this->options.burst; i++) {
+                group.push_back(this->customer_pool.acquire(this, next_customer_id + i));
+                event_log.log(customer_arrived, next_customer_id + i);
+            }
+            this->customers_total += this->options.burst;
+            this->arrives_batch(group, this->arrival_outcomes);
+            for (int i = 0; i < this->options.burst; i++) {
+                group[i]->admitted(this->arrival_outcomes[i]);
+                this->dispatch(group[i], &customer_attr);
+            }
+        }
+        int sleep_value_ms = this->customer_arrival_time();
+        usleep(sleep_value_ms * 1000); // sleep inbetween customer creations
+    }
+    pthread_attr_destroy(&customer_attr);
+    if (this->scaler_wakeup >= 0) { // staffing is frozen from closing time on
+        uint64_t one = 1;
+        if (write(this->scaler_wakeup, &one, sizeof one) != sizeof one) {
+            perror("eventfd");
+            exit(EXIT_FAILURE);
+        }
+        pthread_join(this->scaler, nullptr);
+        ::close(this->scaler_wakeup);
+        this->scaler_wakeup = -1;
+    }
+    this->drain();
+    this->save_trace();
+    this->report();
+}
+
+void Shop::dispatch(Customer* customer, const pthread_attr_t* attr) {
+    if (this->coroutines != nullptr) { // customer is a coroutine, not a thread
+        this->coroutines->spawn(customer->co_run());
+    } else if (this->customer_workers != nullptr) { // hand the customer to an idle pool worker
+        this->customer_workers->submit(customer);
+    } else {
+        pthread_t thread; // detached, so the handle is not needed after creation
+        int rc2 = pthread_create(&thread, attr, run_customer, reinterpret_cast<void *> (customer)); // creating thread
+        if (rc2 != 0) {
+            errno = rc2;
+            perror("creating pthread");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread); // detach thread
+    }
+}
+
+void Shop::drain() {
+    this->close();
+    event_log.log(shop_closes);
+    this->closed_at = this->now();
+    this->waiting_at_close = this->waiting_customers();
+    this->in_service_at_close = this->in_service();
+
+    // Barbers keep serving the waiting room until it is empty or the
+    // drain timeout expires; then whoever is still waiting is sent home.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    long long timeout_ns = deadline.tv_nsec + this->options.drain_timeout_ms * 1000000LL;
+    deadline.tv_sec += timeout_ns / 1000000000LL;
+    deadline.tv_nsec = timeout_ns % 1000000000LL;
+    if (!this->customer_pool.wait_empty(this->options.drain_timeout_ms >= 0 ? &deadline : nullptr)) {
+        for (Customer* customer = this->take_waiting(); customer != nullptr; customer = this->take_waiting()) {
+            this->customers_evicted++;
+            customer->evict();
+        }
+        this->customer_pool.wait_empty(); // only haircuts under way are left
+    }
+
+    if (this->customer_workers != nullptr) { // every customer has left, so the workers are idle
+        this->customer_workers->shutdown();
+        delete this->customer_workers;
+        this->customer_workers = nullptr;
+    }
+    for (auto barber : this->barbers) { // including any who were busy when close() ran
+        barber->closing_time();
+    }
+    if (this->coroutines != nullptr) { // every barber and customer coroutine has finished
+        this->coroutines->drain();
+    }
+    for (auto& thread : barber_threads) {
+        if (thread != nullptr) { // off duty: already joined when he was retired
+            pthread_join(*thread, nullptr);
+            free(thread);
+            thread = nullptr;
+        }
+    }
+    this->drained_at = this->now();
+    this->day_barber_seconds = this->barber_seconds();
+}
+
+void MetricsExporter::start(const string& target, int interval_ms, const vector<Shop*>& shops) {
+    this->socket_mode = target.compare(0, 5, "unix:") == 0;
+    this->path = this->socket_mode ? target.substr(5) : target;
+    this->interval_ms = interval_ms;
+    this->shops = shops;
+    this->wakeup = eventfd(0, EFD_CLOEXEC);
+    if (this->wakeup < 0) {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+    if (this->socket_mode) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof address);
+        address.sun_family = AF_UNIX;
+        if (this->path.size() >= sizeof address.sun_path) {
+            cerr << this->path << ": socket path too long" << endl;
+            exit(EXIT_FAILURE);
+        }
+        strcpy(address.sun_path, this->path.c_str());
+        this->listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unlink(this->path.c_str()); // a stale socket from an earlier run
+        if (this->listener < 0
+                || bind(this->listener, reinterpret_cast<struct sockaddr*> (&address), sizeof address) < 0
+                || listen(this->listener, 16) < 0) {
+            perror(this->path.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    int rc = pthread_create(&this->sampler, nullptr, run_sampler, reinterpret_cast<void*> (this));
+    if (rc != 0) {
+        errno = rc;
+        perror("creating pthread");
+        exit(EXIT_FAILURE);
+    }
+    this->started = true;
+}
+
+void MetricsExporter::stop() {
+    if (!this->started) {
+        return;
+    }
+    this->started = false;
+    uint64_t one = 1;
+    if (write(this->wakeup, &one, sizeof one) != sizeof one) {
+        perror("eventfd");
+    }
+    pthread_join(this->sampler, nullptr);
+    close(this->wakeup);
+    if (this->socket_mode) {
+        close(this->listener);
+        unlink(this->path.c_str());
+    }
+}
+
+void* MetricsExporter::run_sampler(void* arg) {
+    reinterpret_cast<MetricsExporter*> (arg)->sample();
+    return nullptr;
+}
+
+// Take a snapshot every interval; in between, answer socket clients
+// with the latest one.  Returns after publishing a final snapshot once
+// stop() has signalled the eventfd.
+
+void MetricsExporter::sample() {
+    string text;
+    struct pollfd fds[2] = {{this->wakeup, POLLIN, 0}, {this->listener, POLLIN, 0}};
+    int n_fds = this->socket_mode ? 2 : 1;
+    auto next_sample = chrono::steady_clock::now();
+    while (true) {
+        auto now = chrono::steady_clock::now();
+        if (now >= next_sample) {
+            text = this->snapshot();
+            this->publish(text);
+            next_sample = now + chrono::milliseconds(this->interval_ms);
+        }
+        int timeout = (int) chrono::duration_cast<chrono::milliseconds>(next_sample - now).count();
+        if (poll(fds, n_fds, max(timeout, 0)) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (fds[0].revents & POLLIN) { // stop()
+            break;
+        }
+        if (n_fds == 2 && (fds[1].revents & POLLIN)) {
+            int client = accept4(this->listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0) {
+                if (send(client, text.data(), text.size(), MSG_NOSIGNAL) < 0) {
+                    perror("metrics client");
+                }
+                close(client);
+            }
+        }
+    }
+    this->publish(this->snapshot());
+}
+
+string MetricsExporter::snapshot() const {
+    struct Metric {
+        const char* name;
+        const char* type;
+        const char* help;
+        long (*value)(Shop*);
+    };
+    const Metric metrics[] = {
+        {"barbershop_customers_total", "counter", "Customers who arrived.",
+            [](Shop * shop) { return (long) shop->summary().total; }},
+        {"barbershop_customers_served_immediately_total", "counter", "Customers who found a sleeping barber.",
+            [](Shop * shop) { return (long) shop->summary().served_immediately; }},
+        {"barbershop_customers_waited_total", "counter", "Customers who took a waiting-room chair.",
+            [](Shop * shop) { return (long) shop->summary().waited; }},
+        {"barbershop_customers_turned_away_total", "counter", "Customers who found no barber and no chair.",
+            [](Shop * shop) { return (long) shop->summary().turned_away; }},
+        {"barbershop_customers_redirected_out_total", "counter", "Customers sent to a neighboring shard.",
+            [](Shop * shop) { return (long) shop->summary().redirected_out; }},
+        {"barbershop_customers_redirected_in_total", "counter", "Customers admitted from a neighboring shard.",
+            [](Shop * shop) { return (long) shop->summary().redirected_in; }},
+        {"barbershop_customers_stolen_total", "counter", "Waiting customers taken from a neighboring shard.",
+            [](Shop * shop) { return (long) shop->summary().stolen; }},
+        {"barbershop_waiting_customers", "gauge", "Customers in the waiting room.",
+            [](Shop * shop) { return (long) shop->waiting_customers(); }},
+        {"barbershop_sleeping_barbers", "gauge", "Barbers asleep waiting for a customer.",
+            [](Shop * shop) { return (long) shop->sleeping_barber_count(); }},
+        {"barbershop_barbers_on_duty", "gauge", "Barbers working, including asleep ones (--autoscale).",
+            [](Shop * shop) { return (long) shop->barbers_on_duty(); }},
+        {"barbershop_customers_in_service", "gauge", "Haircuts under way.",
+            [](Shop * shop) { return (long) shop->in_service(); }},
+        {"barbershop_open", "gauge", "1 while the shop admits customers.",
+            [](Shop * shop) { return (long) shop->shop_open.load(); }},
+    };
+    string text;
+    char line[200];
+    for (const Metric& metric : metrics) {
+        snprintf(line, sizeof line, "# HELP %s %s\n# TYPE %s %s\n", metric.name, metric.help, metric.name, metric.type);
+        text += line;
+        for (size_t i = 0; i < this->shops.size(); i++) {
+            snprintf(line, sizeof line, "%s{shop=\"%zu\"} %ld\n", metric.name, i, metric.value(this->shops[i]));
+            text += line;
+        }
+    }
+    return text;
+}
+
+void MetricsExporter::publish(const string& text) {
+    if (this->socket_mode) {
+        return; // served on demand by sample()
+    }
+    string temporary = this->path + ".tmp";
+    FILE* out = fopen(temporary.c_str(), "w");
+    if (out == nullptr
+            || fwrite(text.data(), 1, text.size(), out) != text.size()
+            || fclose(out) != 0
+            || rename(temporary.c_str(), this->path.c_str()) != 0) { // readers never see a partial snapshot
+        perror(this->path.c_str());
+    }
+}
+
+void Shop::close() {
+    if (this->options.lock_free) {
+        this->admission.fetch_or(ADMISSION_CLOSED); // arrives() now turns customers away
+        this->shop_open = false;
+        uint64_t word = this->admission.load();
+        while (true) { // claim and wake every sleeping barber
+            int balance = (int) (uint32_t) word;
+            if (balance >= 0) {
+                break;
+            }
+            uint64_t claimed = (word & ADMISSION_CLOSED) | (uint32_t) (balance + 1);
+            if (this->admission.compare_exchange_weak(word, claimed)) {
+                this->barbers[this->idle_barbers->pop()]->closing_time();
+                word = this->admission.load();
+            }
+        }
+        return;
+    }
+
+    vector<Barber*> sleeping;
+    Lock lock(this->shop_mutex, this->lock_stats(shop_lock));
+    this->shop_open = false; // closing the shop; arrives() now turns customers away
+    while (this->sleeping_barbers->size() > 0){
+        sleeping.push_back(sleeping_barbers->pop());
+        this->sleeping_count--;
+    }
+    lock.unlock();
+    
+    for (auto toTerminate : sleeping) {
+        toTerminate->closing_time(); // calling closeing time to set the gohome bool flag of barbers so if they are sleeping and //shop has closed, then closing time will signal them to wake up and go home
+    }
+}
+
+atomic<unsigned long> Shop::generations{0};
+
+// Barber threads are joined by drain(), so a Shop that has finished
+// run() (or was never opened) can be destroyed.
+
+Shop::~Shop() {
+    for (auto recorder : this->recorders) {
+        delete recorder;
+    }
+    for (auto recorder : this->warmup_recorders) {
+        delete recorder;
+    }
+    for (auto barber : this->barbers) {
+        delete barber;
+    }
+    delete this->coroutines;
+    delete this->reactor;
+    delete this->chairs;
+    delete this->sleeping_barbers;
+    delete this->waiting_ring;
+    delete this->idle_barbers;
+}
+
+void Shop::reset_rooms() {
+    delete this->chairs;
+    delete this->sleeping_barbers;
+    this->chairs = WaitingRoom::create(this->options);
+    this->sleeping_barbers = IdleBarbers::create(this->options);
+}
+
+string Shop::layout() const {
+    return "runtime";
+}
+
+void Shop::release_customer(Customer* customer) {
+    this->customer_pool.release(customer);
+}
+
+long long Shop::now() const {
+    if (this->options.virtual_time) {
+        return this->scheduler.now() * 1000000LL;
+    }
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A thread keeps one recorder per shop (per generation), not just the
+// last one: a ShopCluster barber records against his own shop and the
+// shops he steals from, in turn.  Generations are never reused, so an
+// entry for a finished day is simply never found again.
+
+void Shop::record(latency_metric metric, long long nanoseconds) {
+    static thread_local unordered_map<unsigned long, LatencyRecorder*> cached_recorders; // by generation
+    static thread_local unsigned long last_generation = 0; // the common case: the same shop as last time
+    static thread_local LatencyRecorder* last_recorder = nullptr;
+    unsigned long generation = this->generation;
+    if (generation != last_generation) {
+        auto cached = cached_recorders.find(generation);
+        if (cached != cached_recorders.end()) {
+            last_recorder = cached->second;
+        } else { // first sample from this thread for this shop
+            last_recorder = new LatencyRecorder();
+            pthread_mutex_lock(&this->recorders_mutex);
+            this->recorders.push_back(last_recorder);
+            generation = this->generation; // under the lock: the generation of the list it joined
+            pthread_mutex_unlock(&this->recorders_mutex);
+            cached_recorders[generation] = last_recorder;
+        }
+        last_generation = generation;
+    }
+    last_recorder->histograms[metric].record(nanoseconds);
+}
+
+size_t Shop::recorder_count() {
+    pthread_mutex_lock(&this->recorders_mutex);
+    size_t count = this->recorders.size();
+    pthread_mutex_unlock(&this->recorders_mutex);
+    return count;
+}
+
+LatencySummary Shop::latency(latency_metric metric) {
+    LatencySummary summary;
+    pthread_mutex_lock(&this->recorders_mutex);
+    for (auto recorder : this->recorders) {
+        summary.merge(recorder->histograms[metric]);
+    }
+    pthread_mutex_unlock(&this->recorders_mutex);
+    return summary;
+}
+
+ShopSummary Shop::summary() const {
+    ShopSummary summary;
+    summary.served_immediately = this->customers_served_immediately;
+    summary.waited = this->customers_waited;
+    summary.evicted = this->customers_evicted;
+    summary.served = summary.served_immediately + summary.waited - summary.evicted;
+    summary.turned_away = this->customers_turned_away;
+    summary.total = this->customers_total;
+    summary.seed = this->options.seed;
+    summary.redirected_out = this->customers_redirected_out;
+    summary.redirected_in = this->customers_redirected_in;
+    summary.stolen = this->customers_stolen;
+    summary.barber_seconds = this->day_barber_seconds;
+    return summary;
+}
+
+void Shop::report() { // summary statistics for the day
+    if (!this->options.print_summary) {
+        return;
+    }
+    event_log.flush(); // per-event lines first, then the summary
+    cout << "customers served immediately: " << customers_served_immediately << endl;
+    cout << "customers waited " << customers_waited << endl;
+    cout << "total customers served " << (customers_served_immediately + customers_waited - customers_evicted) << endl;
+    cout << "customers turned away: " << customers_turned_away << endl;
+    cout << "total customers: " << customers_total << endl;
+    cout << "seed: " << this->options.seed << endl;
+    const char* waiting_names[] = {"fifo", "sjf", "priority"};
+    cout << "policies: waiting room " << waiting_names[this->options.waiting]
+            << ", idle barbers " << (this->options.lock_free || this->options.idle == idle_lifo ? "lifo" : "fifo") << endl;
+    cout << "at closing: " << this->waiting_at_close << " waiting, " << this->in_service_at_close << " in service; "
+            << customers_evicted << " evicted, drained in " << (this->drained_at - this->closed_at) / 1e6 << " ms" << endl;
+    cout << "placement: " << this->placement.describe() << endl;
+    cout << "layout: " << this->layout() << endl;
+    if (!this->options.lock_free) {
+        unsigned long admitted = customers_served_immediately + customers_waited;
+        cout << "admission: " << admission_locks << " shop_mutex acquisitions in bursts of " << this->options.burst
+                << ", " << (admitted > 0 ? (double) admission_locks / admitted : 0.0) << " per admitted customer" << endl;
+    }
+    if (this->options.warmup_seconds > 0) {
+        cout << "warm-up: first " << (this->measured_from - this->opened_at) / 1e9 << " s left out ("
+                << this->warmup_arrivals << " arrivals); counts, latencies and barber-seconds from then on" << endl;
+    }
+    double day_seconds = (this->drained_at - this->measured_from) / 1e9;
+    cout << "throughput: " << (day_seconds > 0 ? (customers_served_immediately + customers_waited - customers_evicted) / day_seconds : 0.0)
+            << " customers served per second over " << day_seconds << " s" << endl;
+    this->report_locks(day_seconds);
+    if (this->reactor != nullptr) {
+        LatencySummary lag;
+        lag.merge(this->reactor->lag);
+        cout << "reactor: " << this->reactor->wakeups << " timer wakeups for " << lag.total << " events, lag p50 "
+                << lag.percentile(50) / 1e6 << " ms, p99 " << lag.percentile(99) / 1e6 << " ms, max " << lag.max / 1e6 << " ms" << endl;
+    }
+    cout << "peak customers in shop: " << this->customer_pool.peak_live() << endl;
+    cout << "customer pool high-water mark: " << this->customer_pool.high_water_mark() << endl;
+    if (this->options.autoscale_max > 0) {
+        cout << "staffing: autoscaled " << this->options.autoscale_min << ".." << this->options.autoscale_max
+                << " barbers, peak " << this->peak_staffed << ", " << this->hires << " hired, " << this->retirements << " retired, ";
+    } else {
+        cout << "staffing: " << this->n_barbers << " barbers, ";
+    }
+    cout << this->barber_seconds() << " barber-seconds for " << customers_turned_away << " turned away" << endl;
+    if (this->options.rate_schedule.empty()) { // the model assumes one arrival rate for the whole day
+        QueueModel model = mmck_model(this->n_barbers, this->waiting_chairs,
+                effective_service_mean(this->average_service_time, this->service_time_deviation),
+                this->average_customer_arrival);
+        cout << "M/M/c/K model: turn-away rate " << model.blocking << ", mean wait " << model.wait_ms
+                << " ms, barber utilization " << model.utilization << endl;
+    }
+    cout << "measured: turn-away rate " << (customers_total > 0 ? (double) customers_turned_away / customers_total : 0.0)
+            << ", mean wait " << this->latency(waiting_room_latency).mean() / 1e6 << " ms" << endl;
+
+    const char* names[N_LATENCY_METRICS] = {"waiting room", "barber handoff", "service", "total in shop"};
+    char line[160];
+    snprintf(line, sizeof line, "%-16s %10s %10s %10s %10s %10s %8s", "latency (ms)", "p50", "p90", "p99", "p99.9", "max", "count");
+    cout << line << endl;
+    for (int metric = 0; metric < N_LATENCY_METRICS; metric++) {
+        LatencySummary summary = this->latency((latency_metric) metric);
+        snprintf(line, sizeof line, "%-16s %10.3f %10.3f %10.3f %10.3f %10.3f %8llu", names[metric],
+                summary.percentile(50) / 1e6, summary.percentile(90) / 1e6, summary.percentile(99) / 1e6,
+                summary.percentile(99.9) / 1e6, summary.max / 1e6, (unsigned long long) summary.total);
+        cout << line << endl;
+    }
+}
+
+// --lock-profile: per role, acquisitions, how many found the mutex
+// held, the mean wait of those and the mean hold time, and the time
+// held as a share of the (wall-clock) day.  Barbers and customers each have their
+// own handshake mutex, so for those roles the share adds up over every
+// one of them (and can exceed 100%); a single mutex near 100% is the
+// bottleneck.
+
+void Shop::report_locks(double day_seconds) {
+    if (!this->options.lock_profile) {
+        return;
+    }
+    const char* names[N_LOCK_ROLES] = {"shop_mutex", "barber_mutex", "customer_mutex", "rng_mutex"};
+    char line[160];
+    snprintf(line, sizeof line, "%-16s %12s %10s %12s %12s %10s", "lock profile", "acquisitions", "contended",
+            "wait (ns)", "hold (ns)", "held");
+    cout << line << endl;
+    for (int role = 0; role < N_LOCK_ROLES; role++) {
+        const LockStats& stats = this->lock_profiles[role];
+        long acquisitions = stats.acquisitions.load();
+        long contended = stats.contended.load();
+        char held[16] = "-"; // virtual time: the day is not wall-clock time
+        if (!this->options.virtual_time && day_seconds > 0) {
+            snprintf(held, sizeof held, "%.2f%%", 100.0 * stats.hold_ns.load() / (day_seconds * 1e9));
+        }
+        snprintf(line, sizeof line, "%-16s %12ld %9.2f%% %12.0f %12.0f %10s", names[role], acquisitions,
+                acquisitions > 0 ? 100.0 * contended / acquisitions : 0.0,
+                contended > 0 ? (double) stats.wait_ns.load() / contended : 0.0,
+                acquisitions > 0 ? (double) stats.hold_ns.load() / acquisitions : 0.0, held);
+        cout << line << endl;
+    }
+}
+
+// Virtual-time day: customers arrive, barbers cut hair and the shop
+// closes exactly as in the threaded run, but every wait is an event on
+// the scheduler instead of a usleep, so a 300 second day takes
+// milliseconds.  Only the Shop thread runs; the Barber and Customer
+// signal methods are called in protocol order.
+
+void Shop::run_virtual() {
+    this->scheduler.schedule(0, customer_arrival);
+    this->scheduler.schedule(this->duration * 1000LL, shop_closing);
+    if (this->warming_up) {
+        this->scheduler.schedule(this->options.warmup_seconds * 1000LL, warmup_over);
+    }
+    if (this->options.autoscale_max > 0) {
+        this->scheduler.schedule(this->options.scale_interval_ms, scale_check);
+    }
+
+    if (this->reactor != nullptr) {
+        this->reactor->start();
+    }
+    int next_customer_id = 0;
+    while (!this->scheduler.empty()) {
+        if (this->reactor != nullptr) { // in real time: sleep until the event is due
+            this->reactor->wait_until(this->scheduler.next_time());
+        }
+        SimEvent event = this->scheduler.pop();
+        switch (event.type) {
+            case customer_arrival:
+                this->virtual_arrival(next_customer_id);
+                next_customer_id += this->options.burst;
+                break;
+            case haircut_done:
+                this->virtual_haircut_done(event.barber);
+                break;
+            case shop_closing:
+                this->virtual_closing();
+                break;
+            case drain_deadline:
+                this->virtual_drain_deadline();
+                break;
+            case scale_check:
+                if (this->shop_open) { // staffing is frozen from closing time on
+                    this->autoscale();
+                    this->scheduler.schedule(this->scheduler.now() + this->options.scale_interval_ms, scale_check);
+                }
+                break;
+            case warmup_over:
+                this->end_warmup();
+                if (!this->options.what_ifs.empty()) {
+                    this->fork_what_ifs(); // a child returns here as one of the variants
+                }
+                break;
+        }
+    }
+    this->day_barber_seconds = this->barber_seconds();
+    if (this->what_if_result_fd >= 0) { // a what-if child: report to the parent and leave
+        WhatIfResult result = this->what_if_result();
+        if (write(this->what_if_result_fd, &result, sizeof result) != sizeof result) {
+            perror("writing what-if result");
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS); // the parent's buffers and files are not ours to flush
+    }
+    this->save_trace();
+    this->report();
+    this->report_what_ifs();
+    event_log.set_clock(nullptr, nullptr);
+}
+
+// Fork one child per --what-if variant.  Everything buffered is
+// written first so that nothing is printed twice, and each child stops
+// logging: only the parent, which goes on as the baseline, prints.
+
+void Shop::fork_what_ifs() {
+    event_log.flush();
+    cout.flush();
+    for (size_t i = 0; i < this->options.what_ifs.size(); i++) {
+        int fds[2];
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            exit(EXIT_FAILURE);
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            ::close(fds[0]);
+            for (auto& child : this->what_if_children) { // a sibling's pipe
+                ::close(child.result_fd);
+            }
+            this->what_if_children.clear();
+            event_log.detach();
+            this->options.print_summary = false;
+            this->options.record_path.clear();
+            this->what_if_result_fd = fds[1];
+            this->apply(this->options.what_ifs[i]);
+            return;
+        }
+        ::close(fds[1]);
+        this->what_if_children.push_back({pid, fds[0]});
+    }
+}
+
+void Shop::apply(const WhatIf& what_if) {
+    if (what_if.chairs >= 0) {
+        this->waiting_chairs = what_if.chairs; // anyone already seated keeps his chair
+    }
+    if (what_if.service > 0 || what_if.deviation >= 0) { // the generators carry on where the parent's were
+        this->average_service_time = what_if.service > 0 ? what_if.service : this->average_service_time;
+        this->service_time_deviation = what_if.deviation >= 0 ? what_if.deviation : this->service_time_deviation;
+        this->service_variates.reset(this->average_service_time, this->service_time_deviation);
+    }
+    if (what_if.arrival > 0) {
+        this->average_customer_arrival = what_if.arrival; // arrival_mean() picks it up
+    }
+    while (this->staffed < what_if.barbers) {
+        if (count(this->on_duty.begin(), this->on_duty.end(), false) == 0) { // someone for hire() to put on duty
+            this->barbers.push_back(new Barber(this, (int) this->barbers.size()));
+            this->on_duty.push_back(false);
+            this->barber_threads.push_back(nullptr);
+        }
+        this->hire();
+    }
+    this->n_barbers = max(this->n_barbers, what_if.barbers);
+}
+
+Shop::WhatIfResult Shop::what_if_result() {
+    LatencySummary wait = this->latency(waiting_room_latency);
+    return {this->summary(), wait.mean() / 1e6, wait.percentile(99) / 1e6};
+}
+
+// The baseline (this shop) and every variant, measured from the end of
+// the warm-up.
+
+void Shop::report_what_ifs() {
+    if (this->what_if_children.empty()) {
+        return;
+    }
+    vector<pair<string, WhatIfResult>> rows = {{"baseline", this->what_if_result()}};
+    for (auto& child : this->what_if_children) {
+        WhatIfResult result;
+        ssize_t got = read(child.result_fd, &result, sizeof result);
+        int status;
+        waitpid(child.pid, &status, 0);
+        ::close(child.result_fd);
+        if (got != sizeof result || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            cerr << "what-if " << this->options.what_ifs[rows.size() - 1].label << " failed" << endl;
+            exit(EXIT_FAILURE);
+        }
+        rows.push_back({this->options.what_ifs[rows.size() - 1].label, result});
+    }
+    this->what_if_children.clear();
+    if (!this->options.print_summary) {
+        return;
+    }
+    char line[200];
+    snprintf(line, sizeof line, "%-30s %8s %8s %8s %10s %12s %12s %14s", "what-if (after warm-up)",
+            "served", "turned", "total", "turn-away", "wait (ms)", "p99 (ms)", "barber-seconds");
+    cout << line << endl;
+    for (auto& row : rows) {
+        const ShopSummary& s = row.second.summary;
+        snprintf(line, sizeof line, "%-30s %8d %8d %8d %10.4f %12.3f %12.3f %14.3f", row.first.c_str(),
+                s.served, s.turned_away, s.total, s.total > 0 ? (double) s.turned_away / s.total : 0.0,
+                row.second.wait_mean_ms, row.second.wait_p99_ms, s.barber_seconds);
+        cout << line << endl;
+    }
+}
+
+Reactor::Reactor() {
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    this->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (this->epoll_fd < 0 || this->timer_fd < 0) {
+        perror("creating reactor");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = this->timer_fd;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->timer_fd, &event) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+    this->origin = 0;
+}
+
+Reactor::~Reactor() {
+    close(this->timer_fd);
+    close(this->epoll_fd);
+}
+
+void Reactor::start() {
+    this->origin = now();
+}
+
+void Reactor::wait_until(long long ms) {
+    long long due = this->origin + ms * 1000000LL;
+    if (now() < due) {
+        struct itimerspec timer = {};
+        timer.it_value.tv_sec = due / 1000000000LL;
+        timer.it_value.tv_nsec = due % 1000000000LL;
+        if (timerfd_settime(this->timer_fd, TFD_TIMER_ABSTIME, &timer, nullptr) < 0) {
+            perror("timerfd_settime");
+            exit(EXIT_FAILURE);
+        }
+        struct epoll_event event;
+        while (epoll_wait(this->epoll_fd, &event, 1, -1) < 0) {
+            if (errno != EINTR) {
+                perror("epoll_wait");
+                exit(EXIT_FAILURE);
+            }
+        }
+        uint64_t expirations;
+        if (read(this->timer_fd, &expirations, sizeof expirations) != sizeof expirations) {
+            perror("reading timerfd");
+            exit(EXIT_FAILURE);
+        }
+        this->wakeups++;
+    }
+    this->lag.record(now() - due);
+}
+
+long long Shop::virtual_clock(const void* shop) {
+    return reinterpret_cast<const Shop*> (shop)->now();
+}
+
+void Shop::virtual_arrival(int customer_id) {
+    vector<Customer*>& group = this->arrival_group; // --burst customers arrive together
+    vector<BarberOrWait>& outcomes = this->arrival_outcomes;
+    group.clear();
+    for (int i = 0; i < this->options.burst; i++) {
+        group.push_back(this->customer_pool.acquire(this, customer_id + i));
+        event_log.log(customer_arrived, customer_id + i);
+    }
+    this->customers_total += this->options.burst;
+    if (this->options.burst == 1) {
+        outcomes.clear();
+        outcomes.push_back(this->arrives(group[0]));
+    } else {
+        this->arrives_batch(group, outcomes);
+    }
+    for (int i = 0; i < this->options.burst; i++) {
+        Customer * customer = group[i];
+        BarberOrWait b = outcomes[i];
+        if (b.barber != nullptr) {
+            event_log.log(customer_wakes_barber, customer->id, b.barber->id);
+            event_log.log(barber_wakes, b.barber->id);
+            this->virtual_haircut(b.barber, customer);
+        } else if (!b.chair_available) { // a seated customer was logged at admission
+            event_log.log(customer_leaves_unserved, customer->id);
+            this->release_customer(customer);
+        }
+    }
+
+    long long next_arrival = this->scheduler.now() + this->customer_arrival_time();
+    if (next_arrival < this->duration * 1000LL) { // the door is locked at closing time
+        this->scheduler.schedule(next_arrival, customer_arrival);
+    }
+}
+
+// Barber and customer go through the awaken/customer_sits handshake
+// and the haircut is scheduled to finish after a random service time.
+
+void Shop::virtual_haircut(Barber* barber, Customer* customer) {
+    barber->awaken(customer);
+    customer->next_customer(barber);
+    event_log.log(customer_sits_down, customer->id, barber->id);
+    barber->customer_sits();
+    this->record(handoff_latency, barber->seated_at - barber->awakened_at);
+    event_log.log(barber_cuts, barber->id, customer->id);
+    int service = this->service_time(customer);
+    this->service_started();
+    this->record(service_latency, service * 1000000LL);
+    this->scheduler.schedule(this->scheduler.now() + service, haircut_done, barber);
+}
+
+void Shop::virtual_haircut_done(Barber* barber) {
+    Customer * customer = barber->customer();
+    this->service_finished();
+    event_log.log(barber_finishes, barber->id, customer->id);
+    customer->finished();
+    event_log.log(customer_pays, customer->id, barber->id);
+    barber->payment();
+    event_log.log(barber_paid, barber->id, customer->id);
+    customer->payment_accepted();
+    event_log.log(customer_leaves, customer->id);
+    this->release_customer(customer);
+    barber->reset();
+    if (!this->shop_open) {
+        this->drained_at = this->now();
+    }
+
+    Customer * nextcustomer = this->next_customer(barber);
+    if (nextcustomer != nullptr) {
+        event_log.log(barber_calls, barber->id, nextcustomer->id);
+        this->virtual_haircut(barber, nextcustomer);
+    } else if (!this->shop_open) {
+        event_log.log(barber_leaves, barber->id);
+    } else {
+        event_log.log(barber_naps, barber->id);
+    }
+}
+
+void Shop::virtual_drain_deadline() {
+    for (Customer* customer = this->take_waiting(); customer != nullptr; customer = this->take_waiting()) {
+        this->customers_evicted++;
+        event_log.log(customer_leaves_unserved, customer->id);
+        this->release_customer(customer);
+        this->drained_at = this->now();
+    }
+}
+
+void Shop::virtual_closing() {
+    this->waiting_at_close = this->waiting_customers();
+    this->in_service_at_close = this->in_service();
+    this->closed_at = this->drained_at = this->now();
+    if (this->options.drain_timeout_ms >= 0) {
+        this->scheduler.schedule(this->scheduler.now() + this->options.drain_timeout_ms, drain_deadline);
+    }
+    this->close();
+    for (auto barber : this->barbers) {
+        if (barber->gohome && this->on_duty[barber->id]) { // retired barbers went home earlier
+            event_log.log(barber_sent_home, barber->id);
+        }
+    }
+    event_log.log(shop_closes);
+}
+
+// Customer thread announces arrival to shop. If the collection of
+// currently sleeping barbers is not empty, remove and return one
+// barber from the collection. If all the barbers are busy and there
+// is an empty chair in the waiting room, add the customer to the
+// waiting queue and return {nullptr, true}.  Otherwise, the
+// customer will leave: return {nullptr, false}.
+
+Shop::BarberOrWait Shop::arrives(Customer* customer) {
+    this->prepare_arrival(customer);
+    return this->admit(customer, false);
+}
+
+void Shop::prepare_arrival(Customer* customer) {
+    customer->arrived_at = this->now();
+    if (this->options.waiting == waiting_priority) {
+        Lock lock(&this->rng_mutex, this->lock_stats(rng_lock));
+        customer->priority = (int) (this->class_generator() % this->options.priority_classes);
+        lock.unlock();
+    }
+}
+
+// Under shop_mutex, just before the customer is pushed.  Customers
+// served at once or turned away draw nothing here, so sjf takes as
+// many samples from the service stream as fifo (and records the same
+// number to --record).
+
+void Shop::estimate_service(Customer* customer) {
+    if (this->options.waiting == waiting_shortest_service) {
+        customer->service_ms = this->service_time();
+    }
+}
+
+// Batch admission: the random draws happen before the lock, then one
+// pass under shop_mutex hands out sleeping barbers and chairs in
+// arrival order.  Whoever is left over is turned away (or redirected)
+// after the lock is released, since redirecting takes a neighbor's lock.
+
+void Shop::arrives_batch(const vector<Customer*>& customers, vector<BarberOrWait>& outcomes) {
+    outcomes.assign(customers.size(), BarberOrWait{nullptr, false});
+    for (auto customer : customers) {
+        this->prepare_arrival(customer);
+    }
+    if (this->options.lock_free) { // no lock to share: one CAS each
+        for (size_t i = 0; i < customers.size(); i++) {
+            outcomes[i] = this->arrives_lock_free(customers[i], false);
+        }
+        return;
+    }
+
+    size_t admitted = 0;
+    Lock lock(this->shop_mutex, this->lock_stats(shop_lock));
+    this->admission_locks++;
+    bool closed = !this->shop_open;
+    for (; !closed && admitted < customers.size(); admitted++) {
+        if (!this->sleeping_barbers->empty()) {
+            outcomes[admitted] = {this->sleeping_barbers->pop(), true};
+            this->sleeping_count--;
+            this->customers_served_immediately++;
+        } else if ((unsigned int) this->chairs->size() < this->waiting_chairs) {
+            this->estimate_service(customers[admitted]);
+            event_log.log(customer_takes_seat, customers[admitted]->id);
+            this->chairs->push(customers[admitted]);
+            this->queue_depth++;
+            this->customers_waited++;
+            outcomes[admitted] = {nullptr, true};
+        } else {
+            break; // the shop is full for the rest of the group
+        }
+    }
+    lock.unlock();
+    for (size_t i = admitted; i < customers.size(); i++) {
+        outcomes[i] = this->turn_away(customers[i], false, closed);
+    }
+}
+
+Shop::BarberOrWait Shop::admit(Customer* customer, bool redirected) {
+    // Find a sleeping barber.
+    // No barber: check for a waiting-area chair.
+    // Otherwise, customer leaves.
+    if (this->options.lock_free) {
+        return this->arrives_lock_free(customer, redirected);
+    }
+    Barber* wakedup_barber; // waked up barber
+
+    Lock lock(this->shop_mutex, this->lock_stats(shop_lock));
+    this->admission_locks++;
+    if (!this->shop_open) { // arrived after closing time: the door is locked
+        lock.unlock();
+        return this->turn_away(customer, redirected, true);
+    }
+    if (this->sleeping_barbers->empty()) { // if no sleeping barbers
+        if ((unsigned int)this->chairs->size() < this->waiting_chairs) { // check if there is at least one waiting chair
+            this->estimate_service(customer);
+            event_log.log(customer_takes_seat, customer->id); // under shop_mutex, so before any barber_calls for him
+            this->chairs->push(customer); // if there is a chair .. push the customer
+            this->queue_depth++;
+            this->customers_waited++; // increment the counter of customer waited
+            this->customers_redirected_in += redirected;
+            lock.unlock();
+            return {nullptr, true};
+        } else { // if no chairs
+            lock.unlock();
+            return this->turn_away(customer, redirected, false);
+        }
+    } else {
+        wakedup_barber = this->sleeping_barbers->pop(); // if there is a sleeping barber, pop one
+        this->sleeping_count--;
+        this->customers_served_immediately++; // increment the served immediately
+        this->customers_redirected_in += redirected;
+        lock.unlock();
+        return {wakedup_barber, true};
+    }
 }
 
-// Customer thread.  Runs in detatched mode so resources are
-// automagically cleaned up when customer leaves shop.
+// No barber and no chair.  In a ShopCluster the customer first tries
+// the least-loaded neighbor; only if that fails is he turned away.
 
-void* run_customer(void* arg) {
-    Customer* customer = reinterpret_cast<Customer*> (arg);
-    customer->run();
-    delete customer;
-    return nullptr;
+Shop::BarberOrWait Shop::turn_away(Customer* customer, bool redirected, bool closed) {
+    if (redirected) {
+        return {nullptr, false}; // the home shop counts the turn-away
+    }
+    if (!closed && this->options.cluster != nullptr) {
+        BarberOrWait b = this->options.cluster->redirect(this, customer);
+        if (b.barber != nullptr || b.chair_available) {
+            this->customers_redirected_out++;
+            return b;
+        }
+    }
+    this->customers_turned_away++;
+    return {nullptr, false};
 }
 
-Customer::~Customer() {
-    cout << "Calling Customer destructor: Deleting customer" << endl;
-    pthread_cond_destroy(this->cond_customer); // destroying yhe cond variable so no mem leaks
-    pthread_mutex_destroy(this->customer_mutex); // destroying the mutex to free mem
+// Barber thread requests next customer.  If no customers are
+// currently waiting, add the barber to the collection of
+// currently sleeping barbers and return nullptr.
+
+Customer* Shop::next_customer(Barber* barber) {
+    if (this->options.lock_free) {
+        return this->next_customer_lock_free(barber);
+    }
+    Customer * nextcustomer;
+    Lock lock(shop_mutex, this->lock_stats(shop_lock));
+    if (this->chairs->empty() && this->options.cluster != nullptr) {
+        // Nobody waiting here: try to steal from a neighbor before napping.
+        // Our own lock is released first so two shards never hold each
+        // other's shop_mutex.
+        lock.unlock();
+        nextcustomer = this->options.cluster->steal(this);
+        if (nextcustomer != nullptr) {
+            this->customers_stolen++;
+            barber->awaken(nextcustomer);
+            return nextcustomer;
+        }
+        lock.lock();
+    }
+    if (!this->chairs->empty()) {
+        nextcustomer = this->take_waiting_locked(); // assign the next customer
+        barber->awaken(nextcustomer); // assign the barber to the customer by calling awaken
+        lock.unlock();
+        return nextcustomer;
+    } else {
+        sleeping_barbers->push(barber); // if no waiting customers push the barber into sleeping barbers queue
+        this->sleeping_count++;
+        lock.unlock(); 
+        return nullptr;
+    }
 }
 
-void Customer::run() { // customer thread
-    cout << "Customer " << this->id << " arrived at the shop" << endl;
-    bool chair;
-    Barber* wakedup;
-    Shop::BarberOrWait b = this->shop->arrives(this);
-    wakedup = b.barber;
-    chair = b.chair_available;
+Customer* Shop::take_waiting_locked() {
+    Customer * nextcustomer = chairs->pop(); // empty the chairs queue by one, in policy order
+    this->queue_depth--;
+    return nextcustomer;
+}
 
-    if (wakedup == nullptr) { // check if there is no barber available
-        if (chair == true) { // if there is a chair then the customer will wait in the waiting room
-            cout << "Customer " << this->id << " takes a seat in the waiting room" << endl;
-            pthread_mutex_lock(this->customer_mutex);
-            while (this->myBarber == nullptr) { // customer will wait for a barber to call him
-                pthread_cond_wait(this->cond_customer, this->customer_mutex);
+Customer* Shop::take_waiting() {
+    if (this->options.lock_free) {
+        uint64_t word = this->admission.load();
+        while (true) {
+            int balance = (int) (uint32_t) word;
+            if (balance <= 0) {
+                return nullptr;
             }
-            this->customer_state = standup;
-            pthread_mutex_unlock(this->customer_mutex);
+            uint64_t claimed = (word & ADMISSION_CLOSED) | (uint32_t) (balance - 1);
+            if (this->admission.compare_exchange_weak(word, claimed)) {
+                return this->waiting_ring->pop();
+            }
+        }
+    }
+    Customer * nextcustomer = nullptr;
+    Lock lock(shop_mutex, this->lock_stats(shop_lock));
+    if (!this->chairs->empty()) {
+        nextcustomer = this->take_waiting_locked();
+    }
+    lock.unlock();
+    return nextcustomer;
+}
+
+int Shop::waiting_customers() const {
+    if (this->options.lock_free) {
+        return max((int) (uint32_t) this->admission.load(), 0);
+    }
+    return this->queue_depth;
+}
+
+int Shop::sleeping_barber_count() const {
+    if (this->options.lock_free) {
+        return max(-(int) (uint32_t) this->admission.load(), 0);
+    }
+    return this->sleeping_count;
+}
+
+// Lock-free arrives: one CAS on the admission word decides between
+// taking a sleeping barber, taking a chair and leaving, so a chair can
+// never be promised twice and a closed shop admits nobody.
+
+Shop::BarberOrWait Shop::arrives_lock_free(Customer* customer, bool redirected) {
+    uint64_t word = this->admission.load();
+    while (true) {
+        int balance = (int) (uint32_t) word;
+        if (word & ADMISSION_CLOSED || (balance >= 0 && (unsigned int) balance >= this->waiting_chairs)) {
+            return this->turn_away(customer, redirected, word & ADMISSION_CLOSED);
+        }
+        uint64_t admitted = (word & ADMISSION_CLOSED) | (uint32_t) (balance + 1);
+        if (this->admission.compare_exchange_weak(word, admitted)) {
+            this->customers_redirected_in += redirected;
+            if (balance < 0) { // claimed a sleeping barber
+                this->customers_served_immediately++;
+                return {this->barbers[this->idle_barbers->pop()], true};
+            }
+            event_log.log(customer_takes_seat, customer->id); // the chair is ours: logged before a barber can pop him
+            this->waiting_ring->push(customer);
+            this->customers_waited++;
+            return {nullptr, true};
+        }
+    }
+}
+
+// Lock-free next_customer: claim a waiting customer if the balance is
+// positive, otherwise record the barber as asleep and push it on the
+// idle stack.
+
+Customer* Shop::next_customer_lock_free(Barber* barber) {
+    uint64_t word = this->admission.load();
+    bool tried_stealing = false;
+    while (true) {
+        int balance = (int) (uint32_t) word;
+        if (balance <= 0 && !tried_stealing && this->options.cluster != nullptr) {
+            tried_stealing = true; // once: nobody waiting here, so try a neighbor before napping
+            Customer * stolen = this->options.cluster->steal(this);
+            if (stolen != nullptr) {
+                this->customers_stolen++;
+                barber->awaken(stolen);
+                return stolen;
+            }
+            word = this->admission.load();
+            continue;
+        }
+        uint64_t claimed = (word & ADMISSION_CLOSED) | (uint32_t) (balance - 1);
+        if (this->admission.compare_exchange_weak(word, claimed)) {
+            if (balance > 0) {
+                Customer * nextcustomer = this->waiting_ring->pop();
+                barber->awaken(nextcustomer);
+                return nextcustomer;
+            }
+            this->idle_barbers->push(barber->id);
+            return nullptr;
+        }
+    }
+}
+
+int Shop::service_time() { // function to return the sevice time as requested
+    int number;
+    Lock lock(&this->rng_mutex, this->lock_stats(rng_lock));
+    if (this->replayed_services < this->replay.n_services) { // replaying a recorded workload
+        number = this->replay.services[this->replayed_services++];
+    } else {
+        if (!this->options.replay_path.empty()) {
+            this->unreplayed_samples.fetch_add(1, memory_order_relaxed);
+        }
+        if (this->service_time_deviation <= 0) { // no spread: every haircut takes the mean
+            number = this->average_service_time;
         } else {
-            cout << "Customer " << this->id << " leaves without getting a hair cut" << endl;
-	   return; // if the customer has no chairs in the waiting room then it will just leave 
+            number = this->service_variates.draw(this->service_generator); // clipped at 80% of the average service time
         }
+    }
+    if (!this->options.record_path.empty()) {
+        this->recorded_services.push_back(number);
+    }
+    lock.unlock();
+    return number;
+}
+
+int Shop::service_time(const Customer* customer) {
+    return customer->service_ms >= 0 ? customer->service_ms : this->service_time();
+}
+
+int Shop::customer_arrival_time() { // return the customer arrival time using poisson dist
+    int number;
+    if (this->replayed_arrivals < this->replay.n_arrivals) {
+        number = this->replay.arrivals[this->replayed_arrivals++];
     } else {
-        pthread_mutex_lock(this->customer_mutex);
-        this->myBarber = wakedup; // if the customer has a barber then assign its barber to the waked up barber
-        this->customer_state = standup;
-        pthread_mutex_unlock(this->customer_mutex);
+        if (!this->options.replay_path.empty()) {
+            this->unreplayed_samples.fetch_add(1, memory_order_relaxed);
+        }
+        number = this->arrival_variates.draw(this->arrival_generator, this->arrival_mean());
+    }
+    if (!this->options.record_path.empty()) {
+        this->recorded_arrivals.push_back(number);
+    }
+    return number;
+}
+
+// The schedule step in force at this point of the day; before the
+// first step, the avg_customer_arrival_time argument.
+
+int Shop::arrival_mean() {
+    if (this->options.rate_schedule.empty()) {
+        return this->average_customer_arrival;
+    }
+    long long elapsed_ms = (this->now() - this->opened_at) / 1000000;
+    int mean = this->average_customer_arrival;
+    for (auto& step : this->options.rate_schedule) {
+        if (step.first * 1000LL > elapsed_ms) {
+            break;
+        }
+        mean = step.second;
+    }
+    return mean;
+}
+
+// Write the samples drawn so far when recording (--record).  When
+// replaying, say so if the run needed more samples than the trace had.
+
+void Shop::save_trace() {
+    Lock lock(&this->rng_mutex, this->lock_stats(rng_lock));
+    if (!this->options.record_path.empty()) {
+        WorkloadTrace::save(this->options.record_path, this->recorded_arrivals, this->recorded_services);
+    }
+    if (this->unreplayed_samples > 0) {
+        cerr << this->options.replay_path << ": trace exhausted, " << this->unreplayed_samples
+                << " later samples were drawn from seed " << this->options.seed << endl;
+    }
+}
+
+ShopCluster::ShopCluster(int n_barbers,
+        unsigned int waiting_chairs,
+        int average_service_time,
+        int service_time_deviation,
+        int average_customer_arrival,
+        int duration,
+        ShopOptions options) {
+    this->n_barbers = n_barbers;
+    this->waiting_chairs = waiting_chairs;
+    this->average_service_time = average_service_time;
+    this->service_time_deviation = service_time_deviation;
+    this->average_customer_arrival = average_customer_arrival;
+    this->duration = duration;
+    this->options = options;
+    this->options.cluster = this;
+    this->options.print_summary = false; // the cluster reports instead
+    this->shards.resize(options.shards);
+    for (int i = 0; i < options.shards; i++) {
+        this->shards[i] = {this, i, nullptr};
+    }
+}
+
+// Shard thread: pin to a core, build the shard there (so its barber
+// threads inherit the pinning) and run its day.
+
+void* ShopCluster::run_shard(void* arg) {
+    Shard* shard = reinterpret_cast<Shard*> (arg);
+    ShopCluster* cluster = shard->cluster;
+    vector<int> cores = CpuTopology::read().all(); // only the cores this process may use
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cores[shard->index % cores.size()], &cpus);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+    if (rc != 0) {
+        errno = rc;
+        perror("setting shard affinity");
+        exit(EXIT_FAILURE);
+    }
+
+    ShopOptions options = cluster->options;
+    options.seed += shard->index; // distinct streams per shard (ignored unless --seed)
+    shard->shop = new Shop(cluster->n_barbers,
+            cluster->waiting_chairs,
+            cluster->average_service_time,
+            cluster->service_time_deviation,
+            cluster->average_customer_arrival,
+            cluster->duration,
+            options);
+    shard->shop->open(); // before any neighbor can redirect a customer here
+    pthread_barrier_wait(&cluster->opened);
+    cluster->ready.store(true, memory_order_release);
+    if (shard->index == 0 && !options.metrics_path.empty()) { // every shard exists now
+        vector<Shop*> shops;
+        for (auto& each : cluster->shards) {
+            shops.push_back(each.shop);
+        }
+        cluster->metrics.start(options.metrics_path, options.metrics_interval_ms, shops);
+    }
+    shard->shop->run();
+    return nullptr;
+}
+
+void ShopCluster::run() {
+    pthread_barrier_init(&this->opened, NULL, this->shards.size());
+    vector<pthread_t> threads(this->shards.size());
+    for (size_t i = 0; i < this->shards.size(); i++) {
+        int rc = pthread_create(&threads[i], nullptr, run_shard, reinterpret_cast<void*> (&this->shards[i]));
+        if (rc != 0) {
+            errno = rc;
+            perror("creating pthread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (auto thread : threads) {
+        pthread_join(thread, nullptr);
+    }
+    this->metrics.stop();
+    event_log.flush();
+
+    char line[192];
+    const char* format = "%-9s %10s %7s %7s %12s %7s %13s %12s %7s %8s %15s";
+    snprintf(line, sizeof line, format, "shard", "immediate", "waited", "served", "turned_away", "total",
+            "redirect_out", "redirect_in", "stolen", "evicted", "barber_seconds");
+    cout << line << endl;
+    ShopSummary all = {};
+    for (size_t i = 0; i <= this->shards.size(); i++) {
+        ShopSummary shard = i < this->shards.size() ? this->shards[i].shop->summary() : all;
+        snprintf(line, sizeof line, "%-9s %10d %7d %7d %12d %7d %13d %12d %7d %8d %15.1f",
+                i < this->shards.size() ? to_string(i).c_str() : "all",
+                shard.served_immediately, shard.waited, shard.served, shard.turned_away, shard.total,
+                shard.redirected_out, shard.redirected_in, shard.stolen, shard.evicted, shard.barber_seconds);
+        cout << line << endl;
+        all.served_immediately += shard.served_immediately;
+        all.waited += shard.waited;
+        all.served += shard.served;
+        all.turned_away += shard.turned_away;
+        all.total += shard.total;
+        all.redirected_out += shard.redirected_out;
+        all.redirected_in += shard.redirected_in;
+        all.stolen += shard.stolen;
+        all.evicted += shard.evicted;
+        all.barber_seconds += shard.barber_seconds;
+    }
+}
+
+Shop::BarberOrWait ShopCluster::redirect(Shop* from, Customer* customer) {
+    if (!this->ready.load(memory_order_acquire)) {
+        return {nullptr, false};
+    }
+    Shop* target = nullptr;
+    int least = INT_MAX;
+    for (auto& shard : this->shards) {
+        if (shard.shop == from) {
+            continue;
+        }
+        int load = shard.shop->waiting_customers() - shard.shop->sleeping_barber_count();
+        if (load < least) {
+            least = load;
+            target = shard.shop;
+        }
+    }
+    if (target == nullptr) {
+        return {nullptr, false};
+    }
+    return target->admit(customer, true);
+}
+
+size_t ShopCluster::recorder_count() {
+    size_t count = 0;
+    for (auto& shard : this->shards) {
+        count += shard.shop->recorder_count();
+    }
+    return count;
+}
+
+Customer* ShopCluster::steal(Shop* thief) {
+    if (!this->ready.load(memory_order_acquire)) {
+        return nullptr;
+    }
+    Shop* victim = nullptr;
+    int most = 0;
+    for (auto& shard : this->shards) {
+        int waiting = shard.shop == thief ? 0 : shard.shop->waiting_customers();
+        if (waiting > most) {
+            most = waiting;
+            victim = shard.shop;
+        }
+    }
+    return victim == nullptr ? nullptr : victim->take_waiting();
+}
+
+void usage() {
+    cerr
+            << "usage: "
+            << PROG_NAME
+            << " <nbarbers>"
+            << " <nchairs>"
+            << " <avg_service_time>"
+            << " <service_time_std_deviation>"
+            << " <avg_customer_arrival_time>"
+            << " <duration>"
+            << " [--virtual | --reactor]"
+            << " [--pool <ncustomer_threads>]"
+            << " [--lockfree]"
+            << " [--runtime-shop]"
+            << " [--warmup <seconds>] [--what-if <key>=<value>,...]"
+            << " [--lock-profile]"
+            << " [--futex]"
+            << " [--shards <nshops>]"
+            << " [--coroutines <nthreads>]"
+            << " [--replicate <tolerance>]"
+            << " [--metrics <file|unix:path>] [--metrics-interval <ms>]"
+            << " [--drain-timeout <ms>]"
+            << " [--waiting-policy fifo|sjf|priority] [--priority-classes <n>] [--aging <ms>]"
+            << " [--idle-policy fifo|lifo]"
+            << " [--placement none|compact|split|spread] [--barber-cpus <list>] [--customer-cpus <list>]"
+            << " [--customer-stack <KiB>]"
+            << " [--burst <n>]"
+            << " [--rate-schedule <s>:<ms>,...]"
+            << " [--autoscale <min>:<max>] [--scale-interval <ms>] [--scale-thresholds <queue>:<turnaway>:<windows>]"
+            << " [--quiet]"
+            << " [--seed <n>]"
+            << " [--record <trace>]"
+            << " [--event-trace <file>]"
+            << " [--replay <trace>]"
+            << endl
+            << "       "
+            << PROG_NAME
+            << " --sweep"
+            << " <nbarbers> <nchairs> <avg_service_time> <service_time_std_deviation>"
+            << " <avg_customer_arrival_time> <duration> [options]"
+            << endl
+            << "       (each sweep argument is <first>[:<last>[:<step>]])"
+            << endl
+            << "       "
+            << PROG_NAME
+            << " --trace-json <event-trace> <json>"
+            << endl;
+    exit(EXIT_FAILURE);
+}
+
+// Parse --what-if: comma-separated <key>=<value> changes, the keys
+// barbers, chairs, service, deviation and arrival.
+
+bool parse_what_if(const string& text, WhatIf& what_if) {
+    what_if.label = text;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(',', start);
+        string change = text.substr(start, end == string::npos ? string::npos : end - start);
+        size_t equals = change.find('=');
+        int value;
+        char extra;
+        if (equals == string::npos || sscanf(change.c_str() + equals + 1, "%d%c", &value, &extra) != 1 || value < 0) {
+            return false;
+        }
+        string key = change.substr(0, equals);
+        if (key == "barbers" && value > 0) {
+            what_if.barbers = value;
+        } else if (key == "chairs") {
+            what_if.chairs = value;
+        } else if (key == "service" && value > 0) {
+            what_if.service = value;
+        } else if (key == "deviation") {
+            what_if.deviation = value;
+        } else if (key == "arrival" && value > 0) {
+            what_if.arrival = value;
+        } else {
+            return false;
+        }
+        if (end == string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+// Parse --rate-schedule: comma-separated <from second>:<mean ms
+// between arrivals> steps in increasing time order.
+
+bool parse_rate_schedule(const string& text, vector<pair<int, int>>& schedule) {
+    schedule.clear();
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(',', start);
+        string step = text.substr(start, end == string::npos ? string::npos : end - start);
+        int from, mean;
+        char extra;
+        if (sscanf(step.c_str(), "%d:%d%c", &from, &mean, &extra) != 2 || from < 0 || mean <= 0
+                || (!schedule.empty() && from <= schedule.back().first)) {
+            return false;
+        }
+        schedule.push_back({from, mean});
+        if (end == string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+// Parse the optional flags that follow the positional arguments.
+
+void parse_options(int argc, char* argv[], int first, ShopOptions& options, int& verbosity) {
+    bool idle_fifo_given = false; // --idle-policy fifo, as opposed to the default
+    for (int i = first; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--virtual") {
+            options.virtual_time = true;
+        } else if (arg == "--reactor") { // the virtual engine, in real time
+            options.virtual_time = true;
+            options.reactor = true;
+        } else if (arg == "--quiet") { // summary only, no per-event lines
+            verbosity = 0;
+        } else if (arg == "--shards" && i + 1 < argc) {
+            options.shards = atoi(argv[++i]);
+            if (options.shards <= 0) {
+                usage();
+            }
+        } else if (arg == "--coroutines" && i + 1 < argc) {
+            options.coroutine_workers = atoi(argv[++i]);
+            options.futex_handshake = true; // coroutines use the state-word handshake
+            if (options.coroutine_workers <= 0) {
+                usage();
+            }
+        } else if (arg == "--futex") {
+            options.futex_handshake = true;
+        } else if (arg == "--lockfree") {
+            options.lock_free = true;
+        } else if (arg == "--runtime-shop") {
+            options.fixed_layouts = false;
+        } else if (arg == "--lock-profile") {
+            options.lock_profile = true;
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            options.warmup_seconds = atoi(argv[++i]);
+            if (options.warmup_seconds <= 0) {
+                usage();
+            }
+        } else if (arg == "--what-if" && i + 1 < argc) {
+            WhatIf what_if;
+            if (!parse_what_if(argv[++i], what_if)) {
+                usage();
+            }
+            options.what_ifs.push_back(what_if);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = strtoul(argv[++i], nullptr, 0);
+            options.fixed_seed = true;
+        } else if (arg == "--record" && i + 1 < argc) {
+            options.record_path = argv[++i];
+        } else if (arg == "--event-trace" && i + 1 < argc) {
+            options.event_trace_path = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            options.replay_path = argv[++i];
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            options.metrics_path = argv[++i];
+        } else if (arg == "--waiting-policy" && i + 1 < argc) {
+            string policy = argv[++i];
+            if (policy == "fifo") {
+                options.waiting = waiting_fifo;
+            } else if (policy == "sjf") {
+                options.waiting = waiting_shortest_service;
+            } else if (policy == "priority") {
+                options.waiting = waiting_priority;
+            } else {
+                usage();
+            }
+        } else if (arg == "--priority-classes" && i + 1 < argc) {
+            options.priority_classes = atoi(argv[++i]);
+            if (options.priority_classes <= 0) {
+                usage();
+            }
+        } else if (arg == "--aging" && i + 1 < argc) {
+            options.aging_ms = atoi(argv[++i]);
+            if (options.aging_ms <= 0) {
+                usage();
+            }
+        } else if (arg == "--idle-policy" && i + 1 < argc) {
+            string policy = argv[++i];
+            if (policy == "fifo") {
+                options.idle = idle_fifo;
+                idle_fifo_given = true;
+            } else if (policy == "lifo") {
+                options.idle = idle_lifo;
+            } else {
+                usage();
+            }
+        } else if (arg == "--placement" && i + 1 < argc) {
+            string strategy = argv[++i];
+            if (strategy == "none") {
+                options.placement = placement_none;
+            } else if (strategy == "compact") {
+                options.placement = placement_compact;
+            } else if (strategy == "split") {
+                options.placement = placement_split;
+            } else if (strategy == "spread") {
+                options.placement = placement_spread;
+            } else {
+                usage();
+            }
+        } else if ((arg == "--barber-cpus" || arg == "--customer-cpus") && i + 1 < argc) {
+            vector<int> cpus;
+            if (!parse_cpu_list(argv[++i], cpus)) {
+                usage();
+            }
+            (arg == "--barber-cpus" ? options.barber_cpus : options.customer_cpus) = argv[i];
+        } else if (arg == "--rate-schedule" && i + 1 < argc) {
+            if (!parse_rate_schedule(argv[++i], options.rate_schedule)) {
+                usage();
+            }
+        } else if (arg == "--autoscale" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d:%d", &options.autoscale_min, &options.autoscale_max) != 2
+                    || options.autoscale_min <= 0 || options.autoscale_max < options.autoscale_min) {
+                usage();
+            }
+        } else if (arg == "--scale-interval" && i + 1 < argc) {
+            options.scale_interval_ms = atoi(argv[++i]);
+            if (options.scale_interval_ms <= 0) {
+                usage();
+            }
+        } else if (arg == "--scale-thresholds" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d:%lf:%d", &options.scale_up_queue, &options.scale_up_turnaway, &options.scale_down_windows) != 3
+                    || options.scale_up_queue <= 0 || options.scale_up_turnaway < 0 || options.scale_down_windows <= 0) {
+                usage();
+            }
+        } else if (arg == "--burst" && i + 1 < argc) {
+            options.burst = atoi(argv[++i]);
+            if (options.burst <= 0) {
+                usage();
+            }
+        } else if (arg == "--customer-stack" && i + 1 < argc) {
+            options.customer_stack_kb = atoi(argv[++i]);
+            if (options.customer_stack_kb <= 0) {
+                usage();
+            }
+        } else if (arg == "--drain-timeout" && i + 1 < argc) {
+            options.drain_timeout_ms = atoi(argv[++i]);
+            if (options.drain_timeout_ms < 0) {
+                usage();
+            }
+        } else if (arg == "--metrics-interval" && i + 1 < argc) {
+            options.metrics_interval_ms = atoi(argv[++i]);
+            if (options.metrics_interval_ms <= 0) {
+                usage();
+            }
+        } else if (arg == "--replicate" && i + 1 < argc) {
+            options.replicate_tolerance = atof(argv[++i]);
+            if (options.replicate_tolerance <= 0) {
+                usage();
+            }
+        } else if (arg == "--pool" && i + 1 < argc) {
+            options.customer_workers = atoi(argv[++i]);
+            if (options.customer_workers <= 0) {
+                usage();
+            }
+        } else {
+            usage();
+        }
+    }
+    if (options.coroutine_workers > 0 && (options.virtual_time || options.customer_workers > 0)) {
+        usage(); // coroutines replace both the event scheduler and the customer pool
+    }
+    if (options.lock_free && options.waiting != waiting_fifo) {
+        usage(); // the lock-free waiting room is a FIFO ring
+    }
+    if (options.lock_free && idle_fifo_given && options.idle == idle_fifo) {
+        usage(); // the lock-free idle barbers are a LIFO stack
+    }
+    if (options.shards > 1 && !options.record_path.empty()) {
+        usage(); // every shard would write its samples to the same trace
+    }
+    if (options.autoscale_max > 0 && (options.lock_free || options.coroutine_workers > 0 || options.shards > 1)) {
+        usage(); // hiring and retiring go through shop_mutex and barber threads (or virtual barbers)
+    }
+    if (!options.what_ifs.empty() && (options.warmup_seconds == 0 || !options.virtual_time || options.reactor
+            || options.lock_free || options.autoscale_max > 0 || options.shards > 1 || options.replicate_tolerance > 0
+            || !options.metrics_path.empty())) {
+        usage(); // variants fork a single-threaded virtual-time shop at the end of its warm-up
+    }
+}
+
+// Event trace converter (main --trace-json <event-trace> <json>):
+// Chrome trace-event JSON with one track per barber (haircut and nap
+// slices), each customer's wait in the waiting room as an async slice,
+// and a waiting-room occupancy counter.  Prints each barber's
+// utilization, busy time over the time from his arrival to his
+// departure.
+
+struct BarberTimeline {
+    long long first = -1; // first and last event of the barber
+    long long last = -1;
+    long long cut_started = -1; // open slices (-1: none)
+    int customer = -1;
+    long long nap_started = -1;
+    long long busy = 0;
+    long long napping = 0;
+    int haircuts = 0;
+};
+
+int trace_json_main(int argc, char* argv[]) {
+    if (argc != 4) {
+        usage();
+    }
+    FILE* in = fopen(argv[2], "rb");
+    if (in == nullptr) {
+        perror(argv[2]);
+        exit(EXIT_FAILURE);
+    }
+    EventTraceHeader header;
+    if (fread(&header, sizeof header, 1, in) != 1 || memcmp(header.magic, "BSET", 4) != 0
+            || header.version != 1 || header.record_size != sizeof (EventTraceRecord)) {
+        cerr << argv[2] << ": not an event trace" << endl;
+        exit(EXIT_FAILURE);
+    }
+    vector<EventTraceRecord> records;
+    EventTraceRecord record;
+    while (fread(&record, sizeof record, 1, in) == 1) {
+        records.push_back(record);
+    }
+    fclose(in);
+    stable_sort(records.begin(), records.end(), [](const EventTraceRecord& x, const EventTraceRecord& y) {
+        return x.time < y.time; // batches written by different drains may overlap
+    });
+
+    FILE* out = fopen(argv[3], "w");
+    if (out == nullptr) {
+        perror(argv[3]);
+        exit(EXIT_FAILURE);
+    }
+    const int BARBERS_PID = 1, CUSTOMERS_PID = 2;
+    long long origin = records.empty() ? 0 : records[0].time;
+    auto us = [origin](long long time) {
+        return (time - origin) / 1e3;
+    };
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"barbers\"}},\n", BARBERS_PID);
+    fprintf(out, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"customers\"}}", CUSTOMERS_PID);
+    auto slice = [&](const char* name, int tid, long long from, long long to, int customer) {
+        fprintf(out, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                name, BARBERS_PID, tid, us(from), (to - from) / 1e3);
+        if (customer >= 0) {
+            fprintf(out, ",\"args\":{\"customer\":%d}", customer);
+        }
+        fprintf(out, "}");
+    };
+
+    map<int, BarberTimeline> barbers;
+    map<int, long long> seated; // customer -> when he sat down in the waiting room
+    for (const EventTraceRecord& r : records) {
+        switch (r.event) {
+            case barber_arrives: case barber_calls: case barber_leaves: case barber_naps:
+            case barber_sent_home: case barber_wakes: case barber_cuts: case barber_finishes: case barber_paid:
+            {
+                BarberTimeline& barber = barbers[r.a];
+                if (r.event == barber_arrives && barber.first < 0) {
+                    fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"barber %d\"}}",
+                            BARBERS_PID, r.a, r.a);
+                }
+                if (barber.first < 0) {
+                    barber.first = r.time;
+                }
+                barber.last = r.time;
+                if (r.event == barber_naps) {
+                    barber.nap_started = r.time;
+                } else if (barber.nap_started >= 0 && (r.event == barber_wakes || r.event == barber_sent_home || r.event == barber_leaves)) {
+                    slice("nap", r.a, barber.nap_started, r.time, -1);
+                    barber.napping += r.time - barber.nap_started;
+                    barber.nap_started = -1;
+                }
+                if (r.event == barber_cuts) {
+                    barber.cut_started = r.time;
+                    barber.customer = r.b;
+                } else if (r.event == barber_finishes && barber.cut_started >= 0) {
+                    slice("haircut", r.a, barber.cut_started, r.time, barber.customer);
+                    barber.busy += r.time - barber.cut_started;
+                    barber.haircuts++;
+                    barber.cut_started = -1;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        int waiting = -1; // customer whose wait ends here
+        if (r.event == customer_takes_seat) {
+            seated[r.a] = r.time;
+        } else if (r.event == barber_calls && seated.count(r.b)) {
+            waiting = r.b;
+        } else if (r.event == customer_leaves_unserved && seated.count(r.a)) { // evicted at closing
+            waiting = r.a;
+        }
+        if (waiting >= 0) {
+            fprintf(out, ",\n{\"ph\":\"b\",\"cat\":\"customer\",\"name\":\"waiting\",\"id\":%d,\"pid\":%d,\"tid\":0,\"ts\":%.3f}",
+                    waiting, CUSTOMERS_PID, us(seated[waiting]));
+            fprintf(out, ",\n{\"ph\":\"e\",\"cat\":\"customer\",\"name\":\"waiting\",\"id\":%d,\"pid\":%d,\"tid\":0,\"ts\":%.3f}",
+                    waiting, CUSTOMERS_PID, us(r.time));
+            seated.erase(waiting);
+        }
+        if (r.event == customer_takes_seat || waiting >= 0) {
+            fprintf(out, ",\n{\"ph\":\"C\",\"name\":\"waiting room\",\"pid\":%d,\"ts\":%.3f,\"args\":{\"customers\":%zu}}",
+                    CUSTOMERS_PID, us(r.time), seated.size());
+        }
+    }
+    fprintf(out, "\n]}\n");
+    if (fclose(out) != 0) {
+        perror(argv[3]);
+        exit(EXIT_FAILURE);
+    }
+
+    char line[160];
+    snprintf(line, sizeof line, "%-8s %9s %12s %12s %12s %12s", "barber", "haircuts", "busy(ms)", "nap(ms)", "span(ms)", "utilization");
+    cout << line << endl;
+    for (auto& [id, barber] : barbers) {
+        long long span = barber.last - barber.first;
+        snprintf(line, sizeof line, "%-8d %9d %12.3f %12.3f %12.3f %12.3f", id, barber.haircuts,
+                barber.busy / 1e6, barber.napping / 1e6, span / 1e6, span > 0 ? (double) barber.busy / span : 0.0);
+        cout << line << endl;
+    }
+    cout << records.size() << " events written to " << argv[3] << endl;
+    return EXIT_SUCCESS;
+}
+
+// Parameter sweep: one configuration per combination of the six
+// ranges, run concurrently on every core, each in its own Shop.
+
+const int SWEEP_PARAMETERS = 6;
+
+struct SweepRange {
+    int first;
+    int last;
+    int step;
+};
+
+struct SweepJob {
+    int config[SWEEP_PARAMETERS]; // the six positional arguments
+    ShopSummary summary;
+    LatencySummary wait; // waiting-room latency, to compare policies
+};
+
+struct Sweep {
+    vector<SweepJob> jobs;
+    ShopOptions options;
+    atomic<size_t> next_job{0};
+};
+
+SweepRange parse_range(const char* arg) {
+    SweepRange range;
+    range.step = 1;
+    int n = sscanf(arg, "%d:%d:%d", &range.first, &range.last, &range.step);
+    if (n < 1 || range.step <= 0) {
+        usage();
     }
+    if (n == 1) {
+        range.last = range.first;
+    }
+    return range;
+}
 
-    pthread_mutex_lock(this->customer_mutex);
-    cout << "Customer " << this->id << " wakes barber " << this->myBarber->id << endl; // waking up barber
-    this->myBarber->awaken(this); // calling awaken for the customer to awaken the barber assigned to him
-    while (this->awakenedbarber == false) {
-        pthread_cond_wait(this->cond_customer, this->customer_mutex); // after awaking the barber, customer will wait then sit
-        cout << "Customer " << this->id << " sits in barber's " << this->myBarber->id << " chair" << endl;
+void* run_sweep_worker(void* arg) {
+    Sweep* sweep = reinterpret_cast<Sweep*> (arg);
+    for (size_t i = sweep->next_job++; i < sweep->jobs.size(); i = sweep->next_job++) {
+        SweepJob& job = sweep->jobs[i];
+        Shop* shop = Shop::create(job.config[0],
+                job.config[1],
+                job.config[2],
+                job.config[3],
+                job.config[4],
+                job.config[5],
+                sweep->options);
+        shop->run();
+        job.summary = shop->summary();
+        job.wait = shop->latency(waiting_room_latency);
+        delete shop;
     }
-    pthread_mutex_unlock(this->customer_mutex);
+    return nullptr;
+}
 
-    this->myBarber->customer_sits();
+int sweep_main(int argc, char* argv[]) {
+    if (argc < 2 + SWEEP_PARAMETERS) {
+        usage();
+    }
+    const int minimum[SWEEP_PARAMETERS] = {1, 0, 1, 0, 1, 1};
+    SweepRange ranges[SWEEP_PARAMETERS];
+    for (int p = 0; p < SWEEP_PARAMETERS; p++) {
+        ranges[p] = parse_range(argv[2 + p]);
+        if (ranges[p].first < minimum[p] || ranges[p].last < ranges[p].first) {
+            usage();
+        }
+    }
 
-    pthread_mutex_lock(this->customer_mutex);
-    while (this->hadhaircut == false) { // wait until barber finishes the hair cut
-        pthread_cond_wait(this->cond_customer, this->customer_mutex);
-        cout << "Customer " << this->id << " gets up and proffers payment to barber " << this->myBarber->id << endl; //cutomer g       //gets up and offer to pay
+    Sweep sweep;
+    int verbosity = 0;
+    parse_options(argc, argv, 2 + SWEEP_PARAMETERS, sweep.options, verbosity);
+    sweep.options.print_summary = false; // one CSV row per configuration instead
+    if (!sweep.options.metrics_path.empty() || !sweep.options.event_trace_path.empty() // many shops at once, each with its own day
+            || !sweep.options.record_path.empty() || !sweep.options.what_ifs.empty() || sweep.options.warmup_seconds >= ranges[SWEEP_PARAMETERS - 1].first) {
+        usage();
     }
-    pthread_mutex_unlock(this->customer_mutex);
 
-    this->myBarber->payment(); // call the payment method to signal
+    int config[SWEEP_PARAMETERS];
+    for (int p = 0; p < SWEEP_PARAMETERS; p++) {
+        config[p] = ranges[p].first;
+    }
+    while (true) { // odometer over the six ranges, last parameter fastest
+        SweepJob job;
+        copy(config, config + SWEEP_PARAMETERS, job.config);
+        sweep.jobs.push_back(job);
+        int p = SWEEP_PARAMETERS - 1;
+        for (; p >= 0; p--) {
+            config[p] += ranges[p].step;
+            if (config[p] <= ranges[p].last) {
+                break;
+            }
+            config[p] = ranges[p].first;
+        }
+        if (p < 0) {
+            break;
+        }
+    }
 
-    pthread_mutex_lock(this->customer_mutex);
-    while (this->paid == false) {
-        pthread_cond_wait(this->cond_customer, this->customer_mutex); // wait until the barber accepts the payment
-        this->myBarber=nullptr;
-        cout << "Customer " << this->id << " leaves statisfied" << endl; // customer leaves
+    long n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n_workers = min((size_t) max(n_cores, 1L), sweep.jobs.size());
+    vector<pthread_t> workers(n_workers);
+    for (auto& worker : workers) {
+        int rc = pthread_create(&worker, nullptr, run_sweep_worker, reinterpret_cast<void*> (&sweep));
+        if (rc != 0) {
+            errno = rc;
+            perror("creating pthread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (auto worker : workers) {
+        pthread_join(worker, nullptr);
     }
-    pthread_mutex_unlock(this->customer_mutex);
+
+    cout << "nbarbers,nchairs,avg_service_time,service_time_std_deviation,avg_customer_arrival_time,duration,"
+            << "served_immediately,waited,served,turned_away,total,seed,"
+            << "wait_mean_ms,wait_p50_ms,wait_p90_ms,wait_p99_ms,wait_max_ms,barber_seconds" << endl;
+    for (const SweepJob& job : sweep.jobs) {
+        for (int p = 0; p < SWEEP_PARAMETERS; p++) {
+            cout << job.config[p] << ",";
+        }
+        cout << job.summary.served_immediately << ","
+                << job.summary.waited << ","
+                << job.summary.served << ","
+                << job.summary.turned_away << ","
+                << job.summary.total << ","
+                << job.summary.seed << ","
+                << job.wait.mean() / 1e6 << ","
+                << job.wait.percentile(50) / 1e6 << ","
+                << job.wait.percentile(90) / 1e6 << ","
+                << job.wait.percentile(99) / 1e6 << ","
+                << job.wait.max / 1e6 << ","
+                << job.summary.barber_seconds << endl;
+    }
+    return EXIT_SUCCESS;
 }
 
-// Barber calls this customer after checking the waiting-room
-// queue (customer should be waitint).
+// --replicate: independent copies of the day with consecutive seeds,
+// run in parallel batches until the 95% confidence intervals on the
+// turn-away rate and the mean wait are within the tolerance (relative
+// to the mean), then compared with the M/M/c/K model.
 
-void Customer::next_customer(Barber* barber) {
-    pthread_mutex_lock(this->customer_mutex);
-    this->myBarber = barber; // assign the barber to the customer
-    this->awakenedbarber=true;
-    pthread_cond_signal(this->cond_customer);
-    pthread_mutex_unlock(this->customer_mutex);
-}
+const int MIN_REPLICATIONS = 5;
+const int MAX_REPLICATIONS = 10000;
 
-void Customer::finished() { // function to set that the customer finished his hair cut and signal
-    pthread_mutex_lock(this->customer_mutex);
-    this->hadhaircut = true;
-    pthread_cond_signal(this->cond_customer);
-    pthread_mutex_unlock(this->customer_mutex);
+struct Replications {
+    int config[SWEEP_PARAMETERS]; // the six positional arguments
+    ShopOptions options;
+    vector<double> turn_away_rate; // one entry per replication
+    vector<double> mean_wait_ms;
+    atomic<size_t> next{0};
+};
+
+struct Estimate {
+    double mean;
+    double half_width; // 95% confidence interval
+};
+
+Estimate estimate(const vector<double>& samples) {
+    // Student t 0.975 quantiles for 1..30 degrees of freedom
+    const double t_quantile[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    size_t n = samples.size();
+    double sum = 0;
+    for (double x : samples) {
+        sum += x;
+    }
+    double mean = sum / n;
+    double squares = 0;
+    for (double x : samples) {
+        squares += (x - mean) * (x - mean);
+    }
+    double stddev = n > 1 ? sqrt(squares / (n - 1)) : 0;
+    double t = n - 1 <= 30 ? t_quantile[max(n - 1, (size_t) 1) - 1] : 1.96;
+    return {mean, t * stddev / sqrt((double) n)};
 }
 
-void Customer::payment_accepted() { // function to set customer to paid
-    pthread_mutex_lock(this->customer_mutex);
-    this->paid=true;
-    pthread_cond_signal(this->cond_customer);
-    pthread_mutex_unlock(this->customer_mutex);
+void* run_replication_worker(void* arg) {
+    Replications* replications = reinterpret_cast<Replications*> (arg);
+    for (size_t i = replications->next++; i < replications->turn_away_rate.size(); i = replications->next++) {
+        ShopOptions options = replications->options;
+        options.seed += i;
+        Shop* shop = Shop::create(replications->config[0],
+                replications->config[1],
+                replications->config[2],
+                replications->config[3],
+                replications->config[4],
+                replications->config[5],
+                options);
+        shop->run();
+        ShopSummary summary = shop->summary();
+        replications->turn_away_rate[i] = summary.total > 0 ? (double) summary.turned_away / summary.total : 0;
+        replications->mean_wait_ms[i] = shop->latency(waiting_room_latency).mean() / 1e6;
+        delete shop;
+    }
+    return nullptr;
 }
 
-void Barber::run() {
-    cout << "Barber " << this->id << " arrives for work" << endl;
-    Customer * nextcustomer;
-    while (true) { // barber thread goes into an infinite while loop until it gets broken by shop closing
-        nextcustomer = this->shop->next_customer(this); // calls next customer to check the waiting room
-        if (nextcustomer != nullptr) { // if there is a customer waiting then call him
-            cout << "Barber " << this->id << " calls customer " << this->myCustomer->id << endl;
-            nextcustomer->next_customer(this);
-        }
-        else if (nextcustomer == nullptr && !this->shop->shop_open) { // if there are no customers and the shop is closed then b          //arber leaves for home
-            cout << "No more customers and shop is closed, barber " << this->id << " leaves for home" << endl;
-            break;
-        }
-        else { // if there is no csutmers waiting but shop is still open then go for a nap
-            pthread_mutex_lock(this->barber_mutex);
-            cout << "Barber " << this->id << " goes for a nap" << endl;
-            // did the shop close?
-            while (this->myCustomer == nullptr && !this->gohome) {
-                pthread_cond_wait(this->cond_barber, this->barber_mutex); //wait until a customer arrives to wake the barber up
-            }
+int replicate_main(const int config[SWEEP_PARAMETERS], ShopOptions options) {
+    Replications replications;
+    copy(config, config + SWEEP_PARAMETERS, replications.config);
+    if (!options.fixed_seed) {
+        random_device entropy;
+        options.seed = ((unsigned long) entropy() << 32) ^ entropy();
+    }
+    options.fixed_seed = true; // replication i uses seed + i
+    options.print_summary = false;
+    replications.options = options;
+    double tolerance = options.replicate_tolerance;
 
-            if (this->gohome) {
-                cout << "Wake up barber " << this->id << " !!! please go home" << endl; // if while sleeping the shop has closed //then break the loop and go home
-                break;
+    long n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t batch = max((size_t) max(n_cores, 1L), (size_t) MIN_REPLICATIONS);
+    Estimate turn_away = {0, 0};
+    Estimate wait = {0, 0};
+    bool settled = false;
+    while (!settled && replications.turn_away_rate.size() < (size_t) MAX_REPLICATIONS) {
+        size_t n = replications.turn_away_rate.size() + batch;
+        replications.turn_away_rate.resize(n);
+        replications.mean_wait_ms.resize(n);
+        vector<pthread_t> workers(min((size_t) max(n_cores, 1L), batch));
+        for (auto& worker : workers) {
+            int rc = pthread_create(&worker, nullptr, run_replication_worker, reinterpret_cast<void*> (&replications));
+            if (rc != 0) {
+                errno = rc;
+                perror("creating pthread");
+                exit(EXIT_FAILURE);
             }
-            // if no customer, shop must be closed...
-            this->barber_state = awake; 
-            nextcustomer = this->myCustomer; // set the next customer to myCustomer
-            pthread_mutex_unlock(this->barber_mutex);
         }
+        for (auto worker : workers) {
+            pthread_join(worker, nullptr);
+        }
+        turn_away = estimate(replications.turn_away_rate);
+        wait = estimate(replications.mean_wait_ms);
+        settled = turn_away.half_width <= tolerance * turn_away.mean
+                && wait.half_width <= tolerance * wait.mean;
+        cout << "replications " << n << ": turn-away rate " << turn_away.mean << " +/- " << turn_away.half_width
+                << ", mean wait " << wait.mean << " +/- " << wait.half_width << " ms" << endl;
+    }
 
-        // barber services customer
-        // usleep...
-        // customer->finished()
-        // wait_for_payment()
-        //      check (mutex & condition_wait (if necessary)) 
-        //           this->paid or this->state == paid
-        // customer->accepted_payement()
-        //
-        // reset state variables 
+    QueueModel model = mmck_model(config[0], config[1],
+            effective_service_mean(config[2], config[3]), config[4]);
+    cout << (settled ? "settled" : "not settled") << " after " << replications.turn_away_rate.size()
+            << " replications (seeds " << options.seed << "..." << options.seed + replications.turn_away_rate.size() - 1 << ")" << endl;
+    cout << "M/M/c/K model: turn-away rate " << model.blocking << ", mean wait " << model.wait_ms
+            << " ms, barber utilization " << model.utilization << endl;
+    return settled ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-        cout << "Barber " << this->id << " wakes up" << endl;
-        this->myCustomer->next_customer(this); // barber wakes up and sets the next customer to his customer
+#ifdef BARBERS_BENCH
 
-        pthread_mutex_lock(this->barber_mutex);
-        while (this->hassitting == false) { // wait until the customer sits down
-            pthread_cond_wait(this->cond_barber, this->barber_mutex);
-            cout << "Barber " << this->id << " gives customer " << this->myCustomer->id << " a haircut " << endl;
-            usleep(this->shop->service_time()*1000); // service time
-            cout << "Barber " << this->id << " finishes customer " << this->myCustomer->id << "'s haircut " << endl; // finish t//he hair cut
-        }
-        pthread_mutex_unlock(this->barber_mutex);
+// Benchmark executable (build.sh builds it as ./bench): throughput and
+// latency of the Shop hot paths as the number of threads grows, so a
+// synchronization change can be compared against a baseline run.
+//
+//  arrives       callers admit a customer and take one back out of the
+//                waiting room (arrives + take_waiting per op)
+//  arrives_batch the same, admitting groups of 8 with arrives_batch
+//  next_customer barbers call customers from a pre-filled waiting room
+//  round_trip    threaded shop at zero service time: one customer
+//                thread per barber, each op the full arrives, awaken,
+//                customer_sits, finished, payment, payment_accepted
+//                handshake; also run once per --placement strategy
 
-        nextcustomer->finished(); // call finished to signal to customer
+struct BenchResult {
+    string benchmark;
+    string mode;
+    int threads; // callers, or barbers for round_trip
+    unsigned long long ops;
+    double seconds;
+    double p50_us; // round_trip only: arrival to paid
+    double p99_us;
+};
 
-        pthread_mutex_lock(this->barber_mutex);
-        while (this->gotpaid == false) { // wait until the customer pays
-            pthread_cond_wait(this->cond_barber, this->barber_mutex);
-            cout << "Barber " << this->id << " accepts payment from customer " << this->myCustomer->id << endl;
-        }
-        pthread_mutex_unlock(this->barber_mutex);
+struct BenchRun {
+    Shop* shop;
+    double seconds;
+    atomic<bool> go{false};
+    atomic<bool> stop{false};
+    atomic<long> remaining{0}; // next_customer: customers left in the waiting room
+    atomic<unsigned long long> ops{0};
+    atomic<int> ids{0};
+    vector<Customer*> customers; // round_trip: one per customer thread
+    int burst = 1; // arrives: customers admitted per arrives_batch (1: arrives)
+};
 
-        nextcustomer->payment_accepted(); // call payment accepted to signal to customer
+double bench_clock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
 
-        pthread_mutex_lock(this->barber_mutex);
-        this->hassitting = false; // reseting barber states
-        this->gotpaid = false; //resetting states
-        this->myCustomer = nullptr; // unassigning the current customer as he is done with his haircut
-        pthread_mutex_unlock(this->barber_mutex);
+void* run_bench_arrives(void* arg) {
+    BenchRun* run = reinterpret_cast<BenchRun*> (arg);
+    Customer customer(run->shop, run->ids++);
+    vector<Customer*> group(run->burst, &customer); // the same customer may sit in several chairs
+    vector<Shop::BarberOrWait> outcomes;
+    unsigned long long ops = 0;
+    while (!run->go) {
+    }
+    while (!run->stop.load(memory_order_relaxed)) {
+        if (run->burst == 1) {
+            Shop::BarberOrWait b = run->shop->arrives(&customer);
+            if (b.chair_available) {
+                while (run->shop->take_waiting() == nullptr) { // another caller may hold the slot we admitted
+                }
+            }
+        } else {
+            run->shop->arrives_batch(group, outcomes);
+            for (auto& b : outcomes) {
+                if (b.chair_available) {
+                    while (run->shop->take_waiting() == nullptr) {
+                    }
+                }
+            }
+        }
+        ops += run->burst;
     }
+    run->ops += ops;
+    return nullptr;
 }
 
-// Constructor initializes shop and creates Barber threads (which
-// will immediately start calling next_customer to fill the
-// collection of sleeping barbers).
-
-Shop::Shop(int n_barbers,
-        unsigned int waiting_chairs,
-        int average_service_time,
-        int service_time_deviation,
-        int average_customer_arrival,
-        int duration) {
-
-    int rc = clock_gettime(CLOCK_REALTIME, &time_limit);
-    if (rc < 0) {
-        perror("reading realtime clock");
-        exit(EXIT_FAILURE);
+void* run_bench_next_customer(void* arg) {
+    BenchRun* run = reinterpret_cast<BenchRun*> (arg);
+    Barber barber(run->shop, run->ids++);
+    unsigned long long ops = 0;
+    while (!run->go) {
     }
-    // Round to nearest second
-    time_limit.tv_sec += duration + (time_limit.tv_nsec >= 500000000);
-    time_limit.tv_nsec = 0;
-
-    // Initializing mutex
+    while (run->remaining-- > 0) { // a customer is waiting, so next_customer never naps
+        run->shop->next_customer(&barber);
+        ops++;
+    }
+    run->ops += ops;
+    return nullptr;
+}
 
-    this->shop_mutex = reinterpret_cast<pthread_mutex_t*> (malloc(sizeof (pthread_mutex_t))); // memory allocation for shp mutex
-    pthread_mutex_init(this->shop_mutex, NULL); // initializing shop mutex
-    this->n_barbers = n_barbers; // setting number of barbers
-    // Creating Barber Threads
+void* run_bench_customer(void* arg) {
+    BenchRun* run = reinterpret_cast<BenchRun*> (arg);
+    Customer* customer = run->customers[run->ids++];
+    while (!run->go) {
+    }
+    while (!run->stop.load(memory_order_relaxed)) {
+        customer->reuse(run->shop, customer->id);
+        customer->run();
+    }
+    return nullptr;
+}
 
-    cout << "Creating Barber Threads " << n_barbers << " barbers" << endl;
-    for (int i = 0; i< this->n_barbers; i++) {
-        Barber * barber = new Barber(this, i); //id = n_barbers and keeps incrementing 0 -> n_barbers
+// Start `n` threads on `routine`, release them together and wait for
+// them; returns the elapsed wall time.  With `timed` the threads are
+// stopped after run->seconds, otherwise they stop on their own.
 
-        pthread_t* thread = reinterpret_cast<pthread_t*> (calloc(1, sizeof (pthread_t))); // mem allocation for thread
-        int rc = pthread_create(thread, nullptr, run_barber, (void*) barber); // thread creation using the created barber
+double bench_threads(BenchRun* run, int n, void* (*routine)(void*), bool timed, const pthread_attr_t* attr = nullptr) {
+    vector<pthread_t> threads(n);
+    for (auto& thread : threads) {
+        int rc = pthread_create(&thread, attr, routine, reinterpret_cast<void*> (run));
         if (rc != 0) {
             errno = rc;
             perror("creating pthread");
             exit(EXIT_FAILURE);
         }
     }
+    double started = bench_clock();
+    run->go = true;
+    if (timed) {
+        usleep((useconds_t) (run->seconds * 1e6));
+        run->stop = true;
+    }
+    for (auto thread : threads) {
+        pthread_join(thread, nullptr);
+    }
+    return bench_clock() - started;
+}
 
-    this->waiting_chairs = waiting_chairs; //setting shop variables
-    this->average_customer_arrival = average_customer_arrival;
-    this->service_time_deviation = service_time_deviation;
-    this->average_service_time = average_service_time;
+// Shops under benchmark: the runtime Shop, or the FixedShop compiled
+// for exactly that many barbers and chairs.
+typedef Shop* (*BenchShopFactory)(int n_barbers, unsigned int chairs, const ShopOptions& options);
+
+Shop* bench_runtime_shop(int n_barbers, unsigned int chairs, const ShopOptions& options) {
+    return new Shop(n_barbers, chairs, 0, 0, 1, 1, options);
 }
 
-void Shop::run() {
-    //cout << "the Barber shop opens" << endl;
-    if (!shop_open) { // initilizing barber shop
-        this->customers_served_immediately = 0;
-        this->customers_waited = 0;
-        this->customers_turned_away = 0;
-        this->customers_total = 0;
-        this->shop_open = true;
-        cout << "the Barber shop opens" << endl;
+template <int NBarbers, int NChairs>
+Shop* bench_fixed_shop(int n_barbers, unsigned int chairs, const ShopOptions& options) {
+    assert(n_barbers == NBarbers && chairs == NChairs);
+    return new FixedShop<NBarbers, NChairs>(0, 0, 1, 1, options);
+}
+
+BenchShopFactory bench_fixed_round_trip(int n_barbers) { // n barbers and n chairs, powers of two
+    switch (n_barbers) {
+        case 1: return bench_fixed_shop<1, 1>;
+        case 2: return bench_fixed_shop<2, 2>;
+        case 4: return bench_fixed_shop<4, 4>;
+        case 8: return bench_fixed_shop<8, 8>;
+        case 16: return bench_fixed_shop<16, 16>;
+        case 32: return bench_fixed_shop<32, 32>;
+        case 64: return bench_fixed_shop<64, 64>;
+        case 128: return bench_fixed_shop<128, 128>;
+        case 256: return bench_fixed_shop<256, 256>;
+        default: return nullptr;
     }
+}
 
-    for (int next_customer_id = 0;; next_customer_id++) {
-        struct timespec now;
-        clock_gettime(CLOCK_REALTIME, &now);
-        if (now.tv_sec >= time_limit.tv_sec) {
-            // Shop closes.
-            break;
-        }// Wait for random delay, then create new Customer thread.
-        else {
-            pthread_t* thread = reinterpret_cast<pthread_t*> (calloc(1, sizeof (pthread_t))); // mem alloc for customer thread
-            Customer * customer = new Customer(this, next_customer_id); // creating customer
-            this->customers_total++; // incrementing number of customers
-            int rc2 = pthread_create(thread, nullptr, run_customer, reinterpret_cast<void *> (customer)); // creating thread
-            pthread_detach(*thread); // detach thread
-            if (rc2 != 0) {
-                errno = rc2;
-                perror("creating pthread");
-                exit(EXIT_FAILURE);
-            }
-            int sleep_value_ms = this->customer_arrival_time();
-            usleep(sleep_value_ms * 1000); // sleep inbetween customer creations
+BenchResult bench_arrives(ShopOptions options, const string& mode, int n_threads, double seconds, int burst = 1,
+        BenchShopFactory make = bench_runtime_shop) {
+    options.virtual_time = true; // no barber threads: only the callers touch the shop
+    Shop* shop = make(0, 1024, options);
+    shop->open();
+    BenchRun run;
+    run.shop = shop;
+    run.seconds = seconds;
+    run.burst = burst;
+    double elapsed = bench_threads(&run, n_threads, run_bench_arrives, true);
+    delete shop;
+    return {burst == 1 ? "arrives" : "arrives_batch", mode, n_threads, run.ops, elapsed, 0, 0};
+}
+
+BenchResult bench_next_customer(ShopOptions options, const string& mode, int n_threads, double seconds,
+        BenchShopFactory make = bench_runtime_shop) {
+    const long customers = 1 << 18;
+    options.virtual_time = true;
+    BenchResult result = {"next_customer", mode, n_threads, 0, 0, 0, 0};
+    vector<Customer*> waiting;
+    for (long i = 0; i < customers; i++) {
+        waiting.push_back(new Customer(nullptr, (int) i));
+    }
+    while (result.seconds < seconds) { // refill and drain until the time is used up
+        Shop* shop = make(0, customers, options);
+        shop->open();
+        for (auto customer : waiting) {
+            customer->reuse(shop, customer->id);
+            shop->arrives(customer);
         }
+        BenchRun run;
+        run.shop = shop;
+        run.remaining = customers;
+        result.seconds += bench_threads(&run, n_threads, run_bench_next_customer, false);
+        result.ops += run.ops;
+        delete shop;
     }
-    this->shop_open = false; // closing the shop
-    
-    while (this->sleeping_barbers.size() > 0){
-        Barber * toTerminate;
-        toTerminate=sleeping_barbers.front();
-        sleeping_barbers.pop();
-        toTerminate->closing_time(); // calling closeing time to set the gohome bool flag of barbers so if they are sleeping and //shop has closed, then closing time will signal them to wake up and go home
+    for (auto customer : waiting) {
+        delete customer;
     }
-            
-    cout << "the shop closes" << endl;
-    for (auto thread : barber_threads) {
-        pthread_join(*thread, nullptr);
+    return result;
+}
+
+BenchResult bench_round_trip(ShopOptions options, const string& mode, int n_barbers, double seconds,
+        BenchShopFactory make = bench_runtime_shop) {
+    Shop* shop = make(n_barbers, n_barbers, options);
+    shop->open();
+    BenchRun run;
+    run.shop = shop;
+    run.seconds = seconds;
+    for (int i = 0; i < n_barbers; i++) {
+        run.customers.push_back(new Customer(shop, i));
     }
-    cout << "customers served immediately: " << customers_served_immediately << endl;
-    cout << "customers waited " << customers_waited << endl;
-    cout << "total customers served " << (customers_served_immediately + customers_waited) << endl;
-    cout << "customers turned away: " << customers_turned_away << endl;
-    cout << "total customers: " << customers_total << endl;
+    pthread_attr_t attr; // customer threads go where the shop's placement puts them
+    pthread_attr_init(&attr);
+    ThreadPlacement(options).customer_attr(&attr);
+    double elapsed = bench_threads(&run, n_barbers, run_bench_customer, true, &attr);
+    pthread_attr_destroy(&attr);
+    shop->drain(); // the barbers may still be signalling the last customers
+    for (auto customer : run.customers) {
+        delete customer;
+    }
+    LatencySummary total = shop->latency(total_latency);
+    delete shop;
+    return {"round_trip", mode, n_barbers, total.total, elapsed,
+        total.percentile(50) / 1e3, total.percentile(99) / 1e3};
 }
 
-// Customer thread announces arrival to shop. If the collection of
-// currently sleeping barbers is not empty, remove and return one
-// barber from the collection. If all the barbers are busy and there
-// is an empty chair in the waiting room, add the customer to the
-// waiting queue and return {nullptr, true}.  Otherwise, the
-// customer will leave: return {nullptr, false}.
+// Variate generation alone, one thread: `draw` returns one sample.
 
-Shop::BarberOrWait Shop::arrives(Customer* customer) {
-    // Find a sleeping barber.
-    // No barber: check for a waiting-area chair.
-    // Otherwise, customer leaves.
-    BarberOrWait * b= new BarberOrWait(); // fake barber or wait for return purposes to avoid the warning
-    Barber* wakedup_barber; // waked up barber
+volatile long long variate_sink; // keeps the draws from being optimized away
 
-    pthread_mutex_lock(this->shop_mutex);
-    if (this->sleeping_barbers.empty()) { // if no sleeping barbers
-        if ((unsigned int)this->chairs.size() <= (this->waiting_chairs) - 1) { // check if there is at least one waiting chair
-            this->chairs.push(customer); // if there is a chair .. push the customer
-            this->customers_waited++; // increment the counter of customer waited
-            pthread_mutex_unlock(shop_mutex);
-            return {nullptr, true};
-        } else if ((unsigned int)this->chairs.size() == this->waiting_chairs) { // if no chairs
-            this->customers_turned_away++; // increment the number of turned away
-            pthread_mutex_unlock(shop_mutex);
-            return {nullptr, false};
+template <class Draw>
+BenchResult bench_variates(const string& mode, double seconds, Draw draw) {
+    const int BATCH = 4096;
+    BenchResult result = {"variates", mode, 1, 0, 0, 0, 0};
+    long long sum = 0;
+    double started = bench_clock();
+    while (result.seconds < seconds) {
+        for (int i = 0; i < BATCH; i++) {
+            sum += draw();
         }
-    } else {
-        wakedup_barber = this->sleeping_barbers.front(); // if there is a sleeping barber
-        this->sleeping_barbers.pop(); // pop one barber
-        this->customers_served_immediately++; // increment the served immediately
-        pthread_mutex_unlock(shop_mutex);
-        return {wakedup_barber, true};
+        result.ops += BATCH;
+        result.seconds = bench_clock() - started;
     }
-    return *b;
+    variate_sink = sum;
+    return result;
 }
 
-// Barber thread requests next customer.  If no customers are
-// currently waiting, add the barber to the collection of
-// currently sleeping barbers and return nullptr.
-
-Customer* Shop::next_customer(Barber* barber) {
-    Customer * nextcustomer;
-    pthread_mutex_lock(shop_mutex);
-    if (!this->chairs.empty()) {
-        nextcustomer = chairs.front(); // assign the next customer
-        chairs.pop(); // empty the chairs queue by one 
-        barber->awaken(nextcustomer); // assign the barber to the customer by calling awaken
-        pthread_mutex_unlock(shop_mutex);
-        return nextcustomer;
-    } else {
-        sleeping_barbers.push(barber); // if no waiting customers push the barber into sleeping barbers queue
-        pthread_mutex_unlock(shop_mutex); 
-        return nullptr;
-    }
+void bench_usage() {
+    cerr << "usage: bench [--seconds <s>] [--threads <max callers>] [--barbers <max barbers>] [--csv <file>] [--check]" << endl;
+    exit(EXIT_FAILURE);
 }
 
-int Shop::service_time() { // function to return the sevice time as requested
-    int number;
-    std::default_random_engine generator;
-    std::normal_distribution<double> distribution(this->average_service_time, this->service_time_deviation); 
-    do {
-        number = distribution(generator);
-    } while (number < 0.8 * this->average_service_time); // make sure to clip service time by 80% of the barber average ser time
-    return number;
+// bench --check: a ShopCluster with stealing and redirects, its
+// customers on a small pool, so every thread that can record a latency
+// is known.  Each such thread may hold one recorder per shard; barbers
+// switching between their own shop and their victims' must not
+// allocate more.
+bool check_cluster_recorders() {
+    const int SHARDS = 4, BARBERS = 2, WORKERS = 2;
+    ShopOptions options;
+    options.shards = SHARDS;
+    options.customer_workers = WORKERS;
+    options.print_summary = false;
+    ShopCluster cluster(BARBERS, 2, 5, 2, 2, 2, options); // arrivals outpace the barbers: shards redirect and steal
+    cluster.run();
+    size_t threads = SHARDS * (BARBERS + WORKERS + 1); // barbers, pool workers and the shard thread itself
+    size_t bound = threads * SHARDS;
+    size_t recorders = cluster.recorder_count();
+    cout << "cluster recorders: " << recorders << " (bound " << bound << ")" << endl;
+    return recorders <= bound;
 }
 
-int Shop::customer_arrival_time() { // return the customer arrival time using poisson dist
-    std::default_random_engine generator;
-    std::poisson_distribution<int> distribution(this->average_customer_arrival);
-    int number = distribution(generator);
-    return number;
+int bench_main(int argc, char* argv[]) {
+    double seconds = 0.5;
+    int max_threads = max((int) sysconf(_SC_NPROCESSORS_ONLN), 1);
+    int max_barbers = 256;
+    string csv_path = "bench.csv";
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+        } else if (arg == "--barbers" && i + 1 < argc) {
+            max_barbers = atoi(argv[++i]);
+        } else if (arg == "--csv" && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else if (arg == "--check") {
+            return check_cluster_recorders() ? EXIT_SUCCESS : EXIT_FAILURE;
+        } else {
+            bench_usage();
+        }
+    }
+    if (seconds <= 0 || max_threads <= 0 || max_barbers <= 0) {
+        bench_usage();
+    }
+
+    vector<pair<string, ShopOptions>> modes(4);
+    modes[0].first = "mutex";
+    modes[1].first = "lockfree";
+    modes[1].second.lock_free = true;
+    modes[2].first = "futex";
+    modes[2].second.futex_handshake = true;
+    modes[3].first = "lockfree+futex";
+    modes[3].second.lock_free = true;
+    modes[3].second.futex_handshake = true;
+    for (auto& mode : modes) {
+        mode.second.print_summary = false;
+        mode.second.fixed_seed = true; // nothing random is drawn; skip random_device
+    }
+
+    // 1, 2, 4, ... up to and including the maximum
+    auto counts = [](int maximum) {
+        vector<int> counts;
+        for (int n = 1; n < maximum; n *= 2) {
+            counts.push_back(n);
+        }
+        counts.push_back(maximum);
+        return counts;
+    };
+
+    vector<BenchResult> results;
+    auto report = [&results](const BenchResult& result) {
+        char line[160];
+        snprintf(line, sizeof line, "%-14s %-15s %8d %14.0f %12.1f %10.1f %10.1f",
+                result.benchmark.c_str(), result.mode.c_str(), result.threads,
+                result.ops / result.seconds, result.seconds * 1e9 * result.threads / max(result.ops, 1ULL),
+                result.p50_us, result.p99_us);
+        cout << line << endl;
+        results.push_back(result);
+    };
+    cout << "benchmark      mode             threads        ops/sec    ns/op(avg)   p50(us)    p99(us)" << endl;
+    for (int m = 0; m < 2; m++) { // the handshake does not enter arrives or next_customer
+        for (int n : counts(max_threads)) {
+            report(bench_arrives(modes[m].second, modes[m].first, n, seconds));
+        }
+        for (int n : counts(max_threads)) {
+            report(bench_arrives(modes[m].second, modes[m].first, n, seconds, 8));
+        }
+        for (int n : counts(max_threads)) {
+            report(bench_next_customer(modes[m].second, modes[m].first, n, seconds));
+        }
+    }
+    for (int n : counts(max_threads)) { // FixedShop against the mutex rows
+        report(bench_arrives(modes[0].second, "fixed", n, seconds, 1, bench_fixed_shop<0, 1024>));
+    }
+    for (int n : counts(max_threads)) {
+        report(bench_next_customer(modes[0].second, "fixed", n, seconds, bench_fixed_shop<0, 1 << 18>));
+    }
+    for (auto& mode : modes) {
+        for (int n : counts(max_barbers)) {
+            report(bench_round_trip(mode.second, mode.first, n, seconds));
+        }
+    }
+    for (int n : counts(max_barbers)) {
+        if (bench_fixed_round_trip(n) != nullptr) {
+            report(bench_round_trip(modes[0].second, "fixed", n, seconds, bench_fixed_round_trip(n)));
+        }
+    }
+    const char* placements[] = {"compact", "split", "spread"}; // "none" is the mutex run above
+    for (int p = placement_compact; p <= placement_spread; p++) {
+        ShopOptions options = modes[0].second;
+        options.placement = (placement_strategy) p;
+        for (int n : counts(max_barbers)) {
+            report(bench_round_trip(options, string("mutex/") + placements[p - placement_compact], n, seconds));
+        }
+    }
+
+    // Run.sh's defaults: service 1200 +/- 200 ms, arrivals every 400 ms.
+    // The std:: rows are the per-call draws the shop used to make.
+    mt19937_64 generator(1);
+    normal_distribution<double> normal(1200, 200);
+    poisson_distribution<int> poisson(400);
+    ServiceVariates service;
+    service.reset(1200, 200);
+    ArrivalVariates arrivals;
+    report(bench_variates("normal/std", seconds, [&]() {
+        int number;
+        do {
+            number = normal(generator);
+        } while (number < 0.8 * 1200);
+        return number;
+    }));
+    report(bench_variates("normal/block", seconds, [&]() {
+        return service.draw(generator);
+    }));
+    report(bench_variates("poisson/std", seconds, [&]() {
+        return poisson(generator);
+    }));
+    report(bench_variates("poisson/block", seconds, [&]() {
+        return arrivals.draw(generator, 400);
+    }));
+
+    FILE* csv = fopen(csv_path.c_str(), "w");
+    if (csv == nullptr) {
+        perror(csv_path.c_str());
+        exit(EXIT_FAILURE);
+    }
+    fprintf(csv, "benchmark,mode,threads,ops,seconds,ops_per_sec,ns_per_op,p50_us,p99_us\n");
+    for (const BenchResult& result : results) {
+        fprintf(csv, "%s,%s,%d,%llu,%.6f,%.1f,%.1f,%.1f,%.1f\n",
+                result.benchmark.c_str(), result.mode.c_str(), result.threads, result.ops, result.seconds,
+                result.ops / result.seconds, result.seconds * 1e9 * result.threads / max(result.ops, 1ULL),
+                result.p50_us, result.p99_us);
+    }
+    fclose(csv);
+    return EXIT_SUCCESS;
 }
 
-void usage() {
-    cerr
-            << "usage: "
-            << PROG_NAME
-            << " <nbarbers>"
-            << " <nchairs>"
-            << " <avg_service_time>"
-            << " <service_time_std_deviation>"
-            << " <avg_customer_arrival_time>"
-            << " <duration>"
-            << endl;
-    exit(EXIT_FAILURE);
+int main(int argc, char* argv[]) {
+    return bench_main(argc, argv);
 }
 
+#else
+
 int main(int argc, char* argv[]) {
     PROG_NAME = argv[0];
 
-    if (argc != 7) {
+    if (argc >= 2 && string(argv[1]) == "--sweep") {
+        return sweep_main(argc, argv);
+    }
+    if (argc >= 2 && string(argv[1]) == "--trace-json") {
+        return trace_json_main(argc, argv);
+    }
+    if (argc < 7) {
         usage();
     }
     int barbers = atoi(argv[1]);
@@ -656,13 +6286,57 @@ int main(int argc, char* argv[]) {
         usage();
     }
 
-    Shop barber_shop(barbers,
+    ShopOptions options;
+    int verbosity = 1;
+    parse_options(argc, argv, 7, options, verbosity);
+    if (options.warmup_seconds >= duration) {
+        usage(); // nothing left to measure
+    }
+    for (auto& what_if : options.what_ifs) {
+        if (what_if.barbers > 0 && what_if.barbers < barbers) {
+            usage(); // barbers on duty can be added at the fork, not sent home
+        }
+    }
+
+    if (options.replicate_tolerance > 0) {
+        if (options.shards > 1 || !options.record_path.empty() || !options.replay_path.empty()
+                || !options.metrics_path.empty() || !options.event_trace_path.empty()) {
+            usage(); // every replication needs its own Shop and its own random streams
+        }
+        const int config[SWEEP_PARAMETERS] = {barbers, (int) chairs, service_time, service_deviation, customer_arrivals, duration};
+        return replicate_main(config, options);
+    }
+
+    if (options.shards > 1) {
+        if (options.virtual_time) { // shards share one wall clock; there is no cluster-wide virtual clock
+            usage();
+        }
+        event_log.start(verbosity, options.event_trace_path);
+        ShopCluster cluster(barbers,
+                chairs,
+                service_time,
+                service_deviation,
+                customer_arrivals,
+                duration,
+                options);
+        cluster.run();
+        event_log.stop();
+        return EXIT_SUCCESS;
+    }
+
+    event_log.start(verbosity, options.event_trace_path);
+    Shop* barber_shop = Shop::create(barbers,
             chairs,
             service_time,
             service_deviation,
             customer_arrivals,
-            duration);
-    barber_shop.run();
+            duration,
+            options);
+    barber_shop->run();
+    delete barber_shop;
+    event_log.stop();
 
     return EXIT_SUCCESS;
 }
+
+#endif